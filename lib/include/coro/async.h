@@ -1,8 +1,9 @@
 #pragma once
+#include <atomic>
 #include <concepts>
 #include <coroutine>
+#include <cstdint>
 #include <cstdio>
-#include <thread>
 #include <tuple>
 #include <utility>
 #include <type_traits>
@@ -11,11 +12,62 @@
 namespace seele::coro{
 
 
+    // Starts running as soon as it is created. It can be co_await'ed once,
+    // the awaiting coroutine is resumed by symmetric transfer from whichever
+    // thread finishes the task. get() and the destructor block on the same
+    // atomic instead, sleeping until the task finishes.
     template <typename return_t>
     class lazy_task{
     public:
         struct promise_type{
             return_t value;
+            // nullptr, the awaiting coroutine, a pool whose workers wait on
+            // it with the low bit set, or this once finished
+            std::atomic<void*> continuation{nullptr};
+
+            static inline void* helped_by(thread::thread_pool_impl* pool){
+                return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(pool) | 1);
+            }
+
+            inline bool finished() const {
+                return continuation.load(std::memory_order_acquire) == this;
+            }
+
+            inline void wait(){
+                if (finished()) return;
+
+                // a worker blocked here may be the one the task needs next,
+                // every worker of the pool that got here first helps too
+                if (auto pool = thread::thread_pool_impl::current_pool(); pool != nullptr){
+                    void* expected = nullptr;
+                    if (continuation.compare_exchange_strong(expected, helped_by(pool), std::memory_order_acq_rel, std::memory_order_acquire)
+                        || expected == helped_by(pool)){
+                        pool->help_until([this]{ return finished(); });
+                        return;
+                    }
+                }
+                for (void* cur = continuation.load(std::memory_order_acquire); cur != this;
+                     cur = continuation.load(std::memory_order_acquire)){
+                    continuation.wait(cur, std::memory_order_acquire);
+                }
+            }
+
+            struct final_awaiter{
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    auto& p = h.promise();
+                    // the frame may be destroyed as soon as this is published,
+                    // notify only goes by the address and nothing reads it after
+                    void* waiter = p.continuation.exchange(&p, std::memory_order_acq_rel);
+                    p.continuation.notify_all();
+                    if (auto tagged = reinterpret_cast<uintptr_t>(waiter); tagged & 1){
+                        reinterpret_cast<thread::thread_pool_impl*>(tagged & ~uintptr_t{1})->wake_all();
+                        return std::noop_coroutine();
+                    }
+                    return waiter == nullptr ? std::noop_coroutine() : std::coroutine_handle<>::from_address(waiter);
+                }
+                void await_resume() noexcept {}
+            };
 
             auto get_return_object(){
                 return lazy_task{this};
@@ -26,7 +78,7 @@ namespace seele::coro{
             }
 
             auto final_suspend() noexcept{
-                return std::suspend_always{};
+                return final_awaiter{};
             }
             void unhandled_exception() {  }
 
@@ -45,6 +97,30 @@ namespace seele::coro{
 
         handle_type handle;
 
+        template <bool move_result>
+        struct awaiter{
+            handle_type handle;
+
+            bool await_ready() const noexcept { return handle.promise().finished(); }
+            bool await_suspend(std::coroutine_handle<> waiter) noexcept {
+                void* expected = nullptr;
+                if (handle.promise().continuation.compare_exchange_strong(
+                        expected, waiter.address(), std::memory_order_acq_rel, std::memory_order_acquire)){
+                    return true;
+                }
+                // finished meanwhile, or get() got there first and there is
+                // room for one continuation only: wait along with it
+                handle.promise().wait();
+                return false;
+            }
+            decltype(auto) await_resume() noexcept {
+                if constexpr (move_result) {
+                    return std::move(handle.promise().value);
+                } else {
+                    return (handle.promise().value);
+                }
+            }
+        };
 
     public:
 
@@ -55,30 +131,33 @@ namespace seele::coro{
         lazy_task& operator=(const lazy_task& other) = delete;
 
         ~lazy_task(){
-            while (!handle.done())
-                std::this_thread::yield();
-
+            wait();
             handle.destroy();
         }
 
         bool done() const{
-            return handle.done();
+            return handle.promise().finished();
+        }
+
+        // blocks the calling thread; a pool worker runs other coroutines
+        // until the task has finished
+        void wait() const{
+            handle.promise().wait();
         }
 
         return_t& get(){
-            while (!handle.done()){
-                std::this_thread::yield();
-            }
+            wait();
             return handle.promise().value;
         }
 
         return_t&& get_as_rvalue(){
-            while (!handle.done()){
-                std::this_thread::yield();
-            }
+            wait();
             return std::move(handle.promise().value);
         }
 
+        auto operator co_await() & noexcept { return awaiter<false>{handle}; }
+        auto operator co_await() && noexcept { return awaiter<true>{handle}; }
+
     };
 
     template <>
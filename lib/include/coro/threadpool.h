@@ -1,49 +1,136 @@
 #pragma once
 
-#include <climits>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <mutex>
-#include <semaphore>
+#include <optional>
+#include <string>
 #include <thread>
-#include <condition_variable>
-#include <list>
 #include <coroutine>
 #include <vector>
-#include "struct/ms_queue.h"
+#include "struct/ws_deque.h"
+#include "thread_config.h"
 namespace seele::coro::thread {
-    
 
+    struct pool_config{
+        // 0 = one per hardware thread
+        size_t workers = 0;
+        // worker i runs on cpus[i % cpus.size()] only, anywhere if empty
+        std::vector<unsigned> cpus;
+        // workers are named "<name>-<i>"
+        std::string name = "worker";
+    };
+
+    // read when the pool is first used
+    inline pool_config& default_pool_config(){
+        static pool_config c{};
+        return c;
+    }
+
+    // Work-stealing scheduler. A coroutine dispatched from a worker goes to
+    // that worker's LIFO slot and runs next, while what it touched is still
+    // in cache; the one it displaces moves to the worker's deque, whose
+    // oldest entries idle workers steal. Dispatches from other threads go to
+    // the injection queue. Workers with nothing to run park on a futex and
+    // are woken one per dispatch.
     class thread_pool_impl{
     private:
-        std::vector<std::jthread> workers;
+        using handle_t = std::coroutine_handle<>;
+
+        struct alignas(64) worker_t{
+            thread_pool_impl* pool;
+            structs::ws_deque<handle_t> local;
+            // stealable as well, a worker may sit in one coroutine for long
+            std::atomic<handle_t> lifo;
+            uint32_t ticks;
+            uint32_t rng;
+
+            worker_t(thread_pool_impl* pool, uint32_t seed) : pool{pool}, local{}, lifo{nullptr}, ticks{0}, rng{seed} {}
+        };
+
+        std::vector<std::unique_ptr<worker_t>> workers;
+
+        std::mutex inject_m;
+        std::deque<handle_t> injected;
+        std::atomic<size_t> injected_count;
 
-        structs::ms_queue<std::coroutine_handle<>> tasks;
-        std::counting_semaphore<> sem;
+        // bumped to wake parked workers, which wait on it
+        std::atomic<uint32_t> epoch;
+        std::atomic<uint32_t> sleepers;
 
-        void worker(std::stop_token st);
+        std::vector<std::jthread> threads;
 
+        static inline thread_local worker_t* current = nullptr;
 
+        void worker(std::stop_token st, worker_t& w, thread_config config);
+        std::optional<handle_t> next(worker_t& w);
+        std::optional<handle_t> search(worker_t& w);
+        std::optional<handle_t> take_injected();
+        void inject(handle_t h);
+        void wake_one();
 
     public:
+        // the pool the calling thread works for, if any
+        static inline thread_pool_impl* current_pool(){
+            return current != nullptr ? current->pool : nullptr;
+        }
+
+        // For a worker that has to block until done() holds: it keeps
+        // running other coroutines meanwhile, one of which may be what it is
+        // waiting for, and parks when there are none. Whatever makes done()
+        // true calls wake_all() afterwards.
+        template <typename done_t>
+        void help_until(done_t&& done);
+
+        void wake_all(){
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_all();
+        }
+
         static auto& get_instance(){
-            static thread_pool_impl instance{4};
+            static thread_pool_impl instance{default_pool_config()};
             return instance;
-        } 
-
-        auto submit(std::coroutine_handle<> h){
-            tasks.emplace_back(h);
-            sem.release();
         }
 
-        thread_pool_impl(size_t worker_count);
+        void submit(handle_t h);
+
+        explicit thread_pool_impl(const pool_config& config);
+
+        inline size_t size() const { return workers.size(); }
+        thread_pool_impl(const thread_pool_impl&) = delete;
+        thread_pool_impl& operator=(const thread_pool_impl&) = delete;
 
-        ~thread_pool_impl();    
+        ~thread_pool_impl();
 
     };
 
+    template <typename done_t>
+    void thread_pool_impl::help_until(done_t&& done){
+        auto& w = *current;
+        while (!done()){
+            if (auto h = next(w)){
+                h->resume();
+                continue;
+            }
+
+            auto seen = epoch.load(std::memory_order_acquire);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto h = search(w);
+            if (!h && !done()){
+                epoch.wait(seen, std::memory_order_acquire);
+            }
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (h) h->resume();
+        }
+    }
+
     inline auto dispatch(std::coroutine_handle<> handle) {
         thread_pool_impl::get_instance().submit(handle);
-    }    
+    }
 
     struct dispatch_awaiter{
         bool await_ready() { return false; }
@@ -58,9 +145,3 @@ namespace seele::coro::thread {
     };
 
 }
-
-
-
-
-
-
@@ -1,46 +1,124 @@
 #pragma once
+#include <atomic>
 #include <chrono>
 #include <coroutine>
 #include <thread>
 #include <condition_variable>
-#include <map>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
 #include "log.h"
 #include "threadpool.h"
 #include "meta.h"
 #include "math.h"
+#include "struct/timing_wheel.h"
+#include "thread_config.h"
 namespace seele::coro::timer {
 
+    // read when the timer thread starts
+    inline thread_config& default_timer_thread(){
+        static thread_config c{"timer", {}};
+        return c;
+    }
+
+    // process-wide clock that only moves when told to, for simulations and
+    // for fast-forwarding timer driven code
+    struct virtual_clock{
+        using rep = int64_t;
+        using period = std::nano;
+        using duration = std::chrono::duration<rep, period>;
+        using time_point = std::chrono::time_point<virtual_clock>;
+        static constexpr bool is_steady = true;
+
+        static inline time_point now() noexcept {
+            return time_point{duration{ticks.load(std::memory_order_acquire)}};
+        }
+
+        template<typename duration_t>
+            requires seele::meta::is_specialization_of_v<duration_t, std::chrono::duration>
+        static inline void advance(duration_t d){
+            ticks.fetch_add(std::chrono::duration_cast<duration>(d).count(), std::memory_order_acq_rel);
+        }
+
+        // never moves backwards
+        static inline void advance_to(time_point tp){
+            auto target = tp.time_since_epoch().count();
+            auto cur = ticks.load(std::memory_order_acquire);
+            while (cur < target && !ticks.compare_exchange_weak(cur, target, std::memory_order_acq_rel));
+        }
+
+    private:
+        static inline std::atomic<rep> ticks{0};
+    };
+
+    template <typename clock_t>
+    concept manual_clock = requires (typename clock_t::time_point tp) { clock_t::advance_to(tp); };
+
     class delay_task;
+
+    // identifies one submission, cancels it in O(1); stale once it has fired
+    // or been cancelled
+    using timer_id = structs::timing_wheel<std::coroutine_handle<>>::id_t;
+
+    // a timer a delay_task can wait on, enough to cancel the wait without
+    // knowing which timer it is
+    struct timer_source{
+        bool (*cancel)(void* owner, timer_id id);
+        void* owner;
+    };
+
+    template <typename clock_t = std::chrono::steady_clock>
     class timer_impl {
     private:
         std::jthread thread;
         std::condition_variable cv;
         std::mutex m;
 
-        struct task{
-            std::coroutine_handle<> handle;
+        // deadlines are nanoseconds on clock_t
+        structs::timing_wheel<std::coroutine_handle<>> wheel;
+        // something went in that may be due sooner than the worker is waiting for
+        bool rearm;
 
-            inline void async_run(){
-                seele::coro::thread::dispatch(handle);
-            }
+        static inline bool cancel_of(void* owner, timer_id id){
+            return static_cast<timer_impl*>(owner)->cancel(id);
+        }
 
-            inline task(std::coroutine_handle<> handle) : handle{handle} {}
-        };
+        static inline uint64_t ticks(typename clock_t::time_point tp){
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+            return ns < 0 ? 0 : static_cast<uint64_t>(ns);
+        }
 
-        std::map<std::chrono::steady_clock::time_point, task> tasks;
-        void worker(std::stop_token st);
+        static inline typename clock_t::time_point time_point_of(uint64_t ticks){
+            return typename clock_t::time_point{std::chrono::ceil<typename clock_t::duration>(std::chrono::nanoseconds{ticks})};
+        }
 
-        inline explicit timer_impl() : thread{
-                [this](std::stop_token st){
-                    this->worker(st);
-                }
-            }, tasks{} {}
+        void worker(std::stop_token st) requires (!manual_clock<clock_t>);
+        size_t run_due() requires manual_clock<clock_t>;
+
+        // a manual clock has nothing to wait on, expiries are driven by advance()
+        inline explicit timer_impl() : wheel{}, rearm{false}, source{&timer_impl::cancel_of, this} {
+            if constexpr (!manual_clock<clock_t>){
+                thread = std::jthread{
+                    [this, config = default_timer_thread()](std::stop_token st){
+                        if (auto applied = apply_thread_config(config); !applied.has_value()){
+                            seele::log::sync().warn("{}\n", applied.error());
+                        }
+                        this->worker(st);
+                    }
+                };
+            }
+        }
 
         inline ~timer_impl(){
             thread.request_stop();
+            // the worker is either waiting or sees the stop before it does
+            { std::lock_guard lock{m}; }
             cv.notify_one();
+            if (thread.joinable()) thread.join();
         }
     public:
+        const timer_source source;
+
         timer_impl(const timer_impl&) = delete;
         timer_impl& operator=(const timer_impl&) = delete;
         timer_impl(timer_impl&&) = delete;
@@ -51,31 +129,113 @@ namespace seele::coro::timer {
             static timer_impl instance{};
             return instance;
         }
+        // the id is also stored to *id before the timer can fire, so whoever
+        // cancels through it never sees an older one
         template<typename duration_t>
             requires seele::meta::is_specialization_of_v<duration_t, std::chrono::duration>
-        inline bool submit(duration_t delay, std::coroutine_handle<> handle){
+        inline timer_id submit(duration_t delay, std::coroutine_handle<> handle, std::atomic<timer_id>* id = nullptr){
             std::lock_guard lock{m};
-            tasks.emplace(std::chrono::steady_clock::now() + delay, task{handle});
+            auto when = ticks(clock_t::now() + delay);
+            auto next = wheel.next_expiration();
+            auto sooner = !next.has_value() || when < next.value();
+            auto submitted = wheel.insert(when, handle);
+            if (id != nullptr) id->store(submitted, std::memory_order_release);
             seele::log::sync().info("submitting task: {}\n", math::tohex(handle.address()));
-            cv.notify_one();
-            return true;
+            if (sooner){
+                rearm = true;
+                cv.notify_one();
+            }
+            return submitted;
         }
 
-        bool cancel(std::coroutine_handle<> handle);
+        // true if it was still waiting and is now off the timer
+        bool cancel(timer_id id);
 
+        // manual clocks only: expired tasks are resumed on the calling thread,
+        // so a simulation stays single threaded and deterministic
+        template<typename duration_t>
+            requires manual_clock<clock_t> && seele::meta::is_specialization_of_v<duration_t, std::chrono::duration>
+        inline size_t advance(duration_t d){
+            clock_t::advance(d);
+            return run_due();
+        }
+
+        // jumps the clock to the earliest deadline, false if nothing is pending
+        bool advance_to_next() requires manual_clock<clock_t>;
 
     };
 
-    inline void cancel(std::coroutine_handle<> handle){
-        if (timer_impl::get_instance().cancel(handle)){
-            handle.destroy();
-            seele::log::sync().info("destroying task: {}\n", math::tohex(handle.address()));
-        }
+    template <typename clock_t = std::chrono::steady_clock>
+    inline bool cancel(timer_id id){
+        return timer_impl<clock_t>::get_instance().cancel(id);
     }
 
+    // The frame belongs to the delay_task and is destroyed with it, which is
+    // only allowed once it has been cancelled or has finished: a wakeup the
+    // timer already handed to the pool cannot be taken back, so the owner
+    // co_awaits the task whenever cancel() returns false.
     class delay_task{
     public:
         struct promise_type{
+            // nullptr, the awaiting coroutine, a pool whose workers wait on
+            // it with the low bit set, or this once finished
+            std::atomic<void*> continuation{nullptr};
+            // its latest wait on source
+            std::atomic<timer_id> pending{};
+            // the first timer it waited on, the only one it can be cancelled from
+            std::atomic<const timer_source*> source{nullptr};
+
+            // where a wait on from has to store its id, nullptr if it cannot be cancelled
+            inline std::atomic<timer_id>* track(const timer_source& from){
+                const timer_source* expected = nullptr;
+                if (source.compare_exchange_strong(expected, &from, std::memory_order_acq_rel) || expected == &from){
+                    return &pending;
+                }
+                return nullptr;
+            }
+
+            inline bool finished() const {
+                return continuation.load(std::memory_order_acquire) == this;
+            }
+
+            static inline void* helped_by(thread::thread_pool_impl* pool){
+                return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(pool) | 1);
+            }
+
+            // as lazy_task's: a pool worker keeps running other coroutines
+            // meanwhile, the timer wakeup it waits for may be queued behind it
+            inline void wait(){
+                if (finished()) return;
+
+                if (auto pool = thread::thread_pool_impl::current_pool(); pool != nullptr){
+                    void* expected = nullptr;
+                    if (continuation.compare_exchange_strong(expected, helped_by(pool), std::memory_order_acq_rel, std::memory_order_acquire)
+                        || expected == helped_by(pool)){
+                        pool->help_until([this]{ return finished(); });
+                        return;
+                    }
+                }
+                for (void* cur = continuation.load(std::memory_order_acquire); cur != this;
+                     cur = continuation.load(std::memory_order_acquire)){
+                    continuation.wait(cur, std::memory_order_acquire);
+                }
+            }
+
+            struct final_awaiter{
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    auto& p = h.promise();
+                    void* waiter = p.continuation.exchange(&p, std::memory_order_acq_rel);
+                    p.continuation.notify_all();
+                    if (auto tagged = reinterpret_cast<uintptr_t>(waiter); tagged & 1){
+                        reinterpret_cast<thread::thread_pool_impl*>(tagged & ~uintptr_t{1})->wake_all();
+                        return std::noop_coroutine();
+                    }
+                    return waiter == nullptr ? std::noop_coroutine() : std::coroutine_handle<>::from_address(waiter);
+                }
+                void await_resume() noexcept {}
+            };
+
             auto get_return_object(){
                 return delay_task{this};
             }
@@ -85,8 +245,7 @@ namespace seele::coro::timer {
             }
 
             auto final_suspend() noexcept{
-                seele::log::sync().info("final suspend {}\n", math::tohex(this));
-                return std::suspend_never{};
+                return final_awaiter{};
             }
             void unhandled_exception() {  }
 
@@ -97,6 +256,23 @@ namespace seele::coro::timer {
         using handle_type = std::coroutine_handle<promise_type>;
         handle_type handle;
 
+        struct awaiter{
+            handle_type handle;
+
+            bool await_ready() const noexcept { return handle.promise().finished(); }
+            bool await_suspend(std::coroutine_handle<> waiter) noexcept {
+                void* expected = nullptr;
+                if (handle.promise().continuation.compare_exchange_strong(
+                        expected, waiter.address(), std::memory_order_acq_rel, std::memory_order_acquire)){
+                    return true;
+                }
+                // finished meanwhile, or a blocking wait() came first
+                handle.promise().wait();
+                return false;
+            }
+            void await_resume() noexcept {}
+        };
+
     public:
         explicit delay_task(promise_type* p): handle{handle_type::from_promise(*p)}{}
 
@@ -109,34 +285,66 @@ namespace seele::coro::timer {
 
         delay_task& operator=(const delay_task& other) = delete;
         delay_task& operator=(delay_task&& other){
-            handle = other.handle;
-            other.handle = nullptr;
+            std::swap(handle, other.handle);
             return *this;
         }
 
-        ~delay_task() = default;
-
-        void cancel(){
+        ~delay_task(){
             if (handle){
-                seele::coro::timer::cancel(handle);
+                seele::log::sync().info("destroying task: {}\n", math::tohex(handle.address()));
+                handle.destroy();
             }
         }
+
+        bool done() const {
+            return !handle || handle.promise().finished();
+        }
+
+        // blocks the calling thread until the task has finished; a pool
+        // worker runs other coroutines meanwhile
+        void wait() const {
+            if (handle) handle.promise().wait();
+        }
+
+        // false if the task is running or about to, co_await it instead
+        bool cancel(){
+            if (!handle) return false;
+            auto& p = handle.promise();
+            if (p.finished()) return true;
+            auto from = p.source.load(std::memory_order_acquire);
+            return from != nullptr && from->cancel(from->owner, p.pending.load(std::memory_order_acquire));
+        }
+
+        auto operator co_await() noexcept { return awaiter{handle}; }
     };
-    template<typename duration_t>
+
+    // a delay_task records its waits, so it can be cancelled without searching the timer
+    template <typename promise_t>
+    inline std::atomic<timer_id>* tracking(std::coroutine_handle<promise_t> handle, const timer_source& from){
+        if constexpr (std::is_same_v<promise_t, delay_task::promise_type>){
+            return handle.promise().track(from);
+        } else {
+            return nullptr;
+        }
+    }
+
+    template<typename clock_t = std::chrono::steady_clock, typename duration_t>
         requires seele::meta::is_specialization_of_v<duration_t, std::chrono::duration>
-    inline auto delay(duration_t delay, std::coroutine_handle<> handle) {
-        return seele::coro::timer::timer_impl::get_instance().submit(delay, handle);
+    inline auto delay(duration_t delay, std::coroutine_handle<> handle, std::atomic<timer_id>* id = nullptr) {
+        return seele::coro::timer::timer_impl<clock_t>::get_instance().submit(delay, handle, id);
     }
 
-    template<typename duration_t>
+    template<typename duration_t, typename clock_t = std::chrono::steady_clock>
         requires seele::meta::is_specialization_of_v<duration_t, std::chrono::duration>
     struct delay_awaiter{
         duration_t delay;
 
         bool await_ready() { return false; }
 
-        void await_suspend(std::coroutine_handle<> handle) {
-            seele::coro::timer::delay(delay, handle);
+        template <typename promise_t>
+        void await_suspend(std::coroutine_handle<promise_t> handle) {
+            auto& timer = timer_impl<clock_t>::get_instance();
+            timer.submit(delay, handle, tracking(handle, timer.source));
         }
 
         void await_resume() {}
@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "net/udpv4.h"
+#include "coro/timer.h"
+#include "struct/timing_wheel.h"
+#include "thread_config.h"
+
+namespace seele::net{
+
+    // picked up by reactors created afterwards
+    inline thread_config& default_reactor_thread(){
+        static thread_config c{"reactor", {}};
+        return c;
+    }
+
+    // One thread waiting on many sockets, level triggered. Handlers run on
+    // that thread with the registry locked, so they must not block or call
+    // remove(); once remove() returns the handler is not running and will
+    // not run again.
+    //
+    // It keeps timers of its own, a timerfd among the sockets on Linux and
+    // the poll timeout elsewhere. Coroutines waiting on delay() are resumed
+    // on the reactor thread, all that expired at once after the handlers
+    // and with the registry unlocked, so they must not block either.
+    class reactor{
+    public:
+        using handler_t = std::function<void()>;
+        using duration_t = std::chrono::steady_clock::duration;
+
+    private:
+        std::mutex m;
+        std::unordered_map<socket_t, handler_t> handlers;
+
+        std::mutex timer_m;
+        // deadlines are steady_clock nanoseconds
+        structs::timing_wheel<std::coroutine_handle<>> wheel;
+        // what the timer is set to go off at, UINT64_MAX for never
+        uint64_t armed;
+        // reactor thread only, kept for its capacity
+        std::vector<std::coroutine_handle<>> due;
+        #if defined(__linux__)
+        int epfd;
+        int tfd;
+        #endif
+        std::jthread thread;
+
+        void worker(std::stop_token st);
+        // with timer_m held
+        void arm(uint64_t when);
+        void expire();
+        static bool cancel_of(void* owner, coro::timer::timer_id id);
+
+    public:
+        const coro::timer::timer_source source;
+
+        explicit reactor(thread_config config = default_reactor_thread());
+        reactor(const reactor&) = delete;
+        reactor& operator=(const reactor&) = delete;
+        ~reactor();
+
+        // called whenever fd is readable, until removed
+        bool add(socket_t fd, handler_t handler);
+        void remove(socket_t fd);
+        size_t size();
+
+        // resumes handle on the reactor thread after delay, the id is stored
+        // to *id as with timer_impl::submit
+        coro::timer::timer_id schedule(duration_t delay, std::coroutine_handle<> handle, std::atomic<coro::timer::timer_id>* id = nullptr);
+        // true if it was still waiting and is now off the timer
+        bool cancel(coro::timer::timer_id id);
+
+        struct delay_awaiter{
+            reactor& r;
+            duration_t delay;
+
+            bool await_ready() { return false; }
+
+            template <typename promise_t>
+            void await_suspend(std::coroutine_handle<promise_t> handle) {
+                r.schedule(delay, handle, coro::timer::tracking(handle, r.source));
+            }
+
+            void await_resume() {}
+        };
+
+        inline delay_awaiter delay(duration_t d){ return delay_awaiter{*this, d}; }
+    };
+
+}
@@ -5,6 +5,7 @@
 namespace seele::net{
 
     enum class udpv4_error{
+        SOCKET_ERROR,
         BIND_ERROR,
         TIMEOUT_ERROR,
         RECVFROM_ERROR,
@@ -21,8 +22,15 @@ namespace seele::net{
     class udpv4{
     private:
         socket_t socketfd;
+
+        explicit udpv4(socket_t fd) : socketfd{fd} {}
     public:
+        // exits the process if no socket can be created
         explicit udpv4();
+        // socket bound to local, errors are returned instead
+        static std::expected<udpv4, udpv4_error> open(ipv4 local);
+        // takes ownership of a descriptor, e.g. one received from another process
+        static inline udpv4 adopt(socket_t fd) { return udpv4{fd}; }
         udpv4(const udpv4&) = delete;
         udpv4(udpv4&&);
 
@@ -33,6 +41,9 @@ namespace seele::net{
 
         bool bind(ipv4 info);
         bool set_timeout(uint32_t timeout);
+        // recvfrom then fails with TIMEOUT_ERROR instead of waiting
+        bool set_nonblocking();
+        inline socket_t native_handle() const { return socketfd; }
 
         std::expected<size_t, udpv4_error> recvfrom(ipv4& src, void* buffer, size_t buffer_size);
         udpv4_error sendto(const ipv4& dest, const void* data, size_t size);
@@ -48,4 +59,7 @@ namespace seele::net{
 
     std::map<uint32_t, std::tuple<std::u8string, uint32_t>> query_all_device_ip();
 
+    // next hop of the default route, network byte order, 0 if there is none
+    uint32_t query_default_gateway();
+
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace seele::structs {
+    // Fixed-capacity open-addressing hash table split into independently locked
+    // shards. The hash picks the shard from its low bits and the home slot from
+    // the rest; collisions are resolved by linear probing with backward-shift
+    // deletion, so there are no tombstones and nothing is ever allocated after
+    // construction.
+    template <typename key_t, typename value_t, typename hash_t, size_t shard_count = 64, size_t shard_capacity = 1024>
+    class sharded_table {
+        static_assert((shard_count & (shard_count - 1)) == 0, "shard_count must be a power of two");
+        static_assert((shard_capacity & (shard_capacity - 1)) == 0, "shard_capacity must be a power of two");
+    private:
+        struct slot_t{
+            bool used = false;
+            key_t key;
+            value_t value;
+        };
+
+        struct alignas(64) shard_t{
+            std::mutex m;
+            std::unique_ptr<slot_t[]> slots;
+            size_t size = 0;
+        };
+
+        std::unique_ptr<shard_t[]> shards;
+        hash_t hasher;
+
+        static constexpr size_t SHARD_BITS = std::countr_zero(shard_count);
+        static constexpr size_t MASK = shard_capacity - 1;
+
+        inline shard_t& shard_of(size_t h) { return shards[h & (shard_count - 1)]; }
+        inline static size_t home_of(size_t h) { return (h >> SHARD_BITS) & MASK; }
+
+        // slot index holding key, or shard_capacity
+        size_t find_slot(shard_t& s, const key_t& key, size_t h) const;
+        void erase_slot(shard_t& s, size_t i);
+
+    public:
+        sharded_table();
+        sharded_table(const sharded_table&) = delete;
+        sharded_table& operator=(const sharded_table&) = delete;
+
+        // false if the key is present or its shard is full
+        bool insert(const key_t& key, value_t value);
+
+        // f(value&) under the shard lock, false if absent
+        template <typename func_t>
+        bool update(const key_t& key, func_t&& f);
+
+        // f(value&) under the shard lock, then the entry is removed and returned
+        // so the caller can act on it after the lock is released
+        template <typename func_t>
+        std::optional<value_t> take(const key_t& key, func_t&& f);
+
+        static constexpr size_t capacity() { return shard_count * shard_capacity; }
+    };
+
+    template <typename key_t, typename value_t, typename hash_t, size_t shard_count, size_t shard_capacity>
+    sharded_table<key_t, value_t, hash_t, shard_count, shard_capacity>::sharded_table() :
+        shards{std::make_unique<shard_t[]>(shard_count)} {
+        for (size_t i = 0; i < shard_count; i++){
+            shards[i].slots = std::make_unique<slot_t[]>(shard_capacity);
+        }
+    }
+
+    template <typename key_t, typename value_t, typename hash_t, size_t shard_count, size_t shard_capacity>
+    size_t sharded_table<key_t, value_t, hash_t, shard_count, shard_capacity>::find_slot(shard_t& s, const key_t& key, size_t h) const {
+        for (size_t i = home_of(h), n = 0; n < shard_capacity; i = (i + 1) & MASK, n++){
+            auto& slot = s.slots[i];
+            if (!slot.used) return shard_capacity;
+            if (slot.key == key) return i;
+        }
+        return shard_capacity;
+    }
+
+    template <typename key_t, typename value_t, typename hash_t, size_t shard_count, size_t shard_capacity>
+    void sharded_table<key_t, value_t, hash_t, shard_count, shard_capacity>::erase_slot(shard_t& s, size_t i){
+        // shift back every following entry whose home slot lies at or before the hole
+        size_t hole = i;
+        // one lap at most, a full shard has no empty slot to stop at
+        for (size_t j = (i + 1) & MASK, n = 1; n < shard_capacity && s.slots[j].used; j = (j + 1) & MASK, n++){
+            size_t home = home_of(hasher(s.slots[j].key));
+            if (((j - home) & MASK) >= ((j - hole) & MASK)){
+                s.slots[hole].key = s.slots[j].key;
+                s.slots[hole].value = std::move(s.slots[j].value);
+                hole = j;
+            }
+        }
+        s.slots[hole].used = false;
+        s.slots[hole].value = value_t{};
+        s.size--;
+    }
+
+    template <typename key_t, typename value_t, typename hash_t, size_t shard_count, size_t shard_capacity>
+    bool sharded_table<key_t, value_t, hash_t, shard_count, shard_capacity>::insert(const key_t& key, value_t value){
+        size_t h = hasher(key);
+        auto& s = shard_of(h);
+        std::lock_guard lock{s.m};
+
+        if (s.size == shard_capacity) return false;
+        for (size_t i = home_of(h);; i = (i + 1) & MASK){
+            auto& slot = s.slots[i];
+            if (!slot.used){
+                slot.used = true;
+                slot.key = key;
+                slot.value = std::move(value);
+                s.size++;
+                return true;
+            }
+            if (slot.key == key) return false;
+        }
+    }
+
+    template <typename key_t, typename value_t, typename hash_t, size_t shard_count, size_t shard_capacity>
+    template <typename func_t>
+    bool sharded_table<key_t, value_t, hash_t, shard_count, shard_capacity>::update(const key_t& key, func_t&& f){
+        size_t h = hasher(key);
+        auto& s = shard_of(h);
+        std::lock_guard lock{s.m};
+
+        size_t i = find_slot(s, key, h);
+        if (i == shard_capacity) return false;
+        f(s.slots[i].value);
+        return true;
+    }
+
+    template <typename key_t, typename value_t, typename hash_t, size_t shard_count, size_t shard_capacity>
+    template <typename func_t>
+    std::optional<value_t> sharded_table<key_t, value_t, hash_t, shard_count, shard_capacity>::take(const key_t& key, func_t&& f){
+        size_t h = hasher(key);
+        auto& s = shard_of(h);
+        std::lock_guard lock{s.m};
+
+        size_t i = find_slot(s, key, h);
+        if (i == shard_capacity) return std::nullopt;
+        f(s.slots[i].value);
+        std::optional<value_t> res{std::move(s.slots[i].value)};
+        erase_slot(s, i);
+        return res;
+    }
+}
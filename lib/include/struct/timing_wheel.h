@@ -0,0 +1,232 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace seele::structs {
+    // Hierarchical timing wheel over 64-bit ticks, 11 levels of 64 slots:
+    // slot s of level L holds deadlines whose bits 6L..6L+5 are s. An entry
+    // sits at the level of the highest bit in which its deadline differs from
+    // the wheel's current time and drops a level each time its slot comes up,
+    // so inserting, erasing and expiring are O(1) and nothing is ever sorted.
+    // Level 0 slots are one tick wide, deadlines come out exact and in order,
+    // equal ones in the order they went in. Entries live in a slab, an id is
+    // its index and a generation, so a stale id erases nothing.
+    //
+    // A slot is an array of ids rather than a list through the slab: moving
+    // a slot down a level reads entries that are not in memory yet, and from
+    // an array those reads overlap. Erasing only bumps the generation, the
+    // id left behind is dropped when its slot comes up. Not thread safe.
+    template <typename T>
+    class timing_wheel{
+    public:
+        // a default one was never in the wheel; 8-byte aligned, so it fits a
+        // lock-free std::atomic
+        struct alignas(uint64_t) id_t{
+            uint32_t index = 0;
+            uint32_t generation = 0;
+        };
+
+    private:
+        static constexpr size_t SLOT_BITS = 6;
+        static constexpr size_t SLOTS = size_t{1} << SLOT_BITS;
+        static constexpr size_t LEVELS = (64 + SLOT_BITS - 1) / SLOT_BITS;
+
+        struct entry_t{
+            uint64_t when;
+            T value;
+            // odd while the entry is in the wheel
+            uint32_t generation;
+        };
+
+        struct expiry_t{
+            size_t level;
+            size_t slot;
+            uint64_t deadline;
+        };
+
+        std::vector<entry_t> slab;
+        std::vector<uint32_t> free;
+        std::array<std::vector<id_t>, LEVELS * SLOTS> slots;
+        // a bit per non-empty slot
+        std::array<uint64_t, LEVELS> occupied;
+        // entries already due, in the order they became due, from ready_head on
+        std::vector<id_t> ready;
+        size_t ready_head;
+        // a slot being moved down, kept for its capacity
+        std::vector<id_t> moving;
+        // every slot before it has been expired
+        uint64_t elapsed;
+        size_t count;
+
+        static inline size_t level_for(uint64_t elapsed, uint64_t when){
+            auto significant = (elapsed ^ when) | (SLOTS - 1);
+            return (63 - std::countl_zero(significant)) / SLOT_BITS;
+        }
+
+        inline bool live(id_t id) const {
+            return slab[id.index].generation == id.generation;
+        }
+
+        void place(id_t id);
+        // the first non-empty slot, no later than any deadline in the wheel
+        std::optional<expiry_t> next_slot() const;
+        uint64_t slot_start(size_t level, size_t slot) const;
+
+    public:
+        timing_wheel() : occupied{}, ready_head{0}, elapsed{0}, count{0} {}
+        timing_wheel(const timing_wheel&) = delete;
+        timing_wheel& operator=(const timing_wheel&) = delete;
+
+        id_t insert(uint64_t when, T value);
+        // false if it already expired or was erased
+        bool erase(id_t id);
+
+        // the next entry due at now, earliest deadline first
+        std::optional<T> pop(uint64_t now);
+
+        // no later than the earliest deadline, exact when it is near, may
+        // be a slot left with erased entries only
+        std::optional<uint64_t> next_expiration() const;
+        // the earliest deadline
+        std::optional<uint64_t> earliest() const;
+
+        inline size_t size() const { return count; }
+        inline bool empty() const { return count == 0; }
+        void reserve(size_t n){
+            slab.reserve(n);
+            free.reserve(n);
+        }
+    };
+
+    template <typename T>
+    void timing_wheel<T>::place(id_t id){
+        auto when = slab[id.index].when;
+        if (when <= elapsed){
+            ready.push_back(id);
+            return;
+        }
+        auto level = level_for(elapsed, when);
+        auto slot = (when >> (level * SLOT_BITS)) & (SLOTS - 1);
+        slots[level * SLOTS + slot].push_back(id);
+        occupied[level] |= uint64_t{1} << slot;
+    }
+
+    template <typename T>
+    uint64_t timing_wheel<T>::slot_start(size_t level, size_t slot) const{
+        auto shift = (level + 1) * SLOT_BITS;
+        uint64_t level_start = shift >= 64 ? 0 : elapsed & ~((uint64_t{1} << shift) - 1);
+        return level_start + (uint64_t{slot} << (level * SLOT_BITS));
+    }
+
+    template <typename T>
+    std::optional<typename timing_wheel<T>::expiry_t> timing_wheel<T>::next_slot() const{
+        // every entry of a level is due before any entry of the levels above
+        for (size_t level = 0; level < LEVELS; level++){
+            if (occupied[level] == 0) continue;
+
+            auto slot = static_cast<size_t>(std::countr_zero(occupied[level]));
+            return expiry_t{level, slot, slot_start(level, slot)};
+        }
+        return std::nullopt;
+    }
+
+    template <typename T>
+    typename timing_wheel<T>::id_t timing_wheel<T>::insert(uint64_t when, T value){
+        uint32_t i;
+        if (!free.empty()){
+            i = free.back();
+            free.pop_back();
+        } else {
+            i = static_cast<uint32_t>(slab.size());
+            slab.push_back(entry_t{0, T{}, 0});
+        }
+        auto& e = slab[i];
+        e.when = when;
+        e.value = std::move(value);
+        e.generation++;
+        id_t id{i, e.generation};
+        place(id);
+        count++;
+        return id;
+    }
+
+    template <typename T>
+    bool timing_wheel<T>::erase(id_t id){
+        if (id.index >= slab.size() || !live(id)) return false;
+        auto& e = slab[id.index];
+        e.generation++;
+        e.value = T{};
+        free.push_back(id.index);
+        count--;
+        return true;
+    }
+
+    template <typename T>
+    std::optional<T> timing_wheel<T>::pop(uint64_t now){
+        while (true){
+            while (ready_head < ready.size() && !live(ready[ready_head])) ready_head++;
+            if (ready_head < ready.size()) break;
+            ready.clear();
+            ready_head = 0;
+
+            auto exp = next_slot();
+            if (!exp.has_value() || exp->deadline > now){
+                // safe as long as it stays short of the next slot
+                elapsed = std::max(elapsed, now);
+                return std::nullopt;
+            }
+
+            elapsed = exp->deadline;
+            std::swap(moving, slots[exp->level * SLOTS + exp->slot]);
+            occupied[exp->level] &= ~(uint64_t{1} << exp->slot);
+            // in order, so equal deadlines keep theirs
+            for (auto id : moving){
+                if (live(id)) place(id);
+            }
+            moving.clear();
+        }
+
+        auto id = ready[ready_head++];
+        std::optional<T> value{std::move(slab[id.index].value)};
+        erase(id);
+        return value;
+    }
+
+    template <typename T>
+    std::optional<uint64_t> timing_wheel<T>::next_expiration() const{
+        if (count == 0) return std::nullopt;
+        for (auto i = ready_head; i < ready.size(); i++){
+            if (live(ready[i])) return slab[ready[i].index].when;
+        }
+        auto exp = next_slot();
+        if (!exp.has_value()) return std::nullopt;
+        return exp->deadline;
+    }
+
+    template <typename T>
+    std::optional<uint64_t> timing_wheel<T>::earliest() const{
+        for (auto i = ready_head; i < ready.size(); i++){
+            if (live(ready[i])) return slab[ready[i].index].when;
+        }
+        // slots in time order, the first with a live entry holds the
+        // earliest deadlines, unsorted above level 0
+        for (size_t level = 0; level < LEVELS; level++){
+            for (auto bits = occupied[level]; bits != 0; bits &= bits - 1){
+                auto slot = static_cast<size_t>(std::countr_zero(bits));
+                auto best = UINT64_MAX;
+                for (auto id : slots[level * SLOTS + slot]){
+                    if (live(id)) best = std::min(best, slab[id.index].when);
+                }
+                if (best != UINT64_MAX) return best;
+            }
+        }
+        return std::nullopt;
+    }
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+namespace seele::structs {
+    // Bounded Chase-Lev work-stealing deque, with the memory orders of Le et
+    // al., "Correct and Efficient Work-Stealing for Weak Memory Models". The
+    // owning thread pushes and pops at the bottom, any thread steals from the
+    // top. A full deque refuses the push, the caller decides where the item
+    // goes instead, so nothing is allocated after construction.
+    template <typename T, size_t capacity = 256>
+        requires std::is_trivially_copyable_v<T>
+    class ws_deque {
+        static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+    private:
+        static constexpr int64_t MASK = capacity - 1;
+
+        alignas(64) std::atomic<int64_t> top;
+        alignas(64) std::atomic<int64_t> bottom;
+        std::array<std::atomic<T>, capacity> items;
+
+    public:
+        ws_deque() : top{0}, bottom{0}, items{} {}
+        ws_deque(const ws_deque&) = delete;
+        ws_deque& operator=(const ws_deque&) = delete;
+
+        // owner only, false if full
+        bool push(T item);
+        // owner only, the most recently pushed
+        std::optional<T> pop();
+        // any thread, the oldest
+        std::optional<T> steal();
+
+        bool is_empty() const {
+            return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+        }
+    };
+
+    template <typename T, size_t capacity>
+        requires std::is_trivially_copyable_v<T>
+    bool ws_deque<T, capacity>::push(T item){
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        if (b - t >= static_cast<int64_t>(capacity)) return false;
+
+        items[b & MASK].store(item, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename T, size_t capacity>
+        requires std::is_trivially_copyable_v<T>
+    std::optional<T> ws_deque<T, capacity>::pop(){
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+
+        if (t > b){
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        std::optional<T> item = items[b & MASK].load(std::memory_order_relaxed);
+        if (t == b){
+            // the last one, a thief may be after it too
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+                item.reset();
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    template <typename T, size_t capacity>
+        requires std::is_trivially_copyable_v<T>
+    std::optional<T> ws_deque<T, capacity>::steal(){
+        while (true){
+            auto t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto b = bottom.load(std::memory_order_acquire);
+            if (t >= b) return std::nullopt;
+
+            // a slot is only reused once top has moved past it, which fails the exchange
+            auto item = items[t & MASK].load(std::memory_order_relaxed);
+            if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+                return item;
+            }
+        }
+    }
+
+}
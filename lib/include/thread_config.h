@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <expected>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace seele {
+
+    // how a long running thread is named and where it may run
+    struct thread_config{
+        // Linux keeps the first 15 characters
+        std::string name;
+        // logical CPUs the thread may run on, any if empty
+        std::vector<unsigned> cpus;
+    };
+
+    // applies config to the calling thread
+    std::expected<void, std::string> apply_thread_config(const thread_config& config);
+
+    // "0-3,8,10-11"
+    std::expected<std::vector<unsigned>, std::string> parse_cpu_list(std::string_view list);
+
+    // std::thread::hardware_concurrency(), at least 1
+    size_t hardware_threads();
+}
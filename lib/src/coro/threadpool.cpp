@@ -1,31 +1,141 @@
+#include <format>
+
 #include "coro/threadpool.h"
+#include "log.h"
 
 namespace seele::coro::thread {
 
-    void thread_pool_impl::worker(std::stop_token st){
-        while(sem.acquire(), !st.stop_requested()){
-            
-           auto h = tasks.pop_front();
+    namespace {
+        // every this many coroutines a worker looks at the oldest work first,
+        // so a pair that keeps dispatching each other cannot starve the rest
+        constexpr uint32_t fairness_interval = 61;
+
+        uint32_t xorshift(uint32_t& s){
+            s ^= s << 13;
+            s ^= s >> 17;
+            s ^= s << 5;
+            return s;
+        }
+    }
+
+    void thread_pool_impl::submit(handle_t h){
+        if (current != nullptr && current->pool == this){
+            auto displaced = current->lifo.exchange(h, std::memory_order_seq_cst);
+            if (displaced && !current->local.push(displaced)){
+                inject(displaced);
+                return;
+            }
+        } else {
+            inject(h);
+            return;
+        }
+        wake_one();
+    }
 
-            h->resume();
+    void thread_pool_impl::inject(handle_t h){
+        {
+            std::lock_guard lock{inject_m};
+            injected.push_back(h);
+            injected_count.fetch_add(1, std::memory_order_seq_cst);
         }
+        wake_one();
     }
-    thread_pool_impl::thread_pool_impl(size_t worker_count) : sem{0} {
+
+    std::optional<thread_pool_impl::handle_t> thread_pool_impl::take_injected(){
+        if (injected_count.load(std::memory_order_seq_cst) == 0) return std::nullopt;
+        std::lock_guard lock{inject_m};
+        if (injected.empty()) return std::nullopt;
+        auto h = injected.front();
+        injected.pop_front();
+        injected_count.fetch_sub(1, std::memory_order_relaxed);
+        return h;
+    }
+
+    void thread_pool_impl::wake_one(){
+        // pairs with the fence in worker(): either the parking worker sees
+        // the new work or this sees it counted as a sleeper
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) == 0) return;
+        epoch.fetch_add(1, std::memory_order_release);
+        epoch.notify_one();
+    }
+
+    std::optional<thread_pool_impl::handle_t> thread_pool_impl::next(worker_t& w){
+        if (++w.ticks % fairness_interval == 0){
+            if (auto h = take_injected()) return h;
+            if (auto h = w.local.steal()) return h;
+        }
+        if (auto h = w.lifo.exchange(nullptr, std::memory_order_seq_cst)) return h;
+        if (auto h = w.local.pop()) return h;
+        return search(w);
+    }
+
+    std::optional<thread_pool_impl::handle_t> thread_pool_impl::search(worker_t& w){
+        if (auto h = take_injected()) return h;
+
+        // from a random victim on, so thieves spread out
+        auto n = workers.size();
+        auto start = xorshift(w.rng) % n;
+        for (size_t i = 0; i < n; i++){
+            auto& victim = *workers[(start + i) % n];
+            if (&victim == &w) continue;
+            if (auto h = victim.local.steal()) return h;
+            if (auto h = victim.lifo.exchange(nullptr, std::memory_order_seq_cst)) return h;
+        }
+        return std::nullopt;
+    }
+
+    void thread_pool_impl::worker(std::stop_token st, worker_t& w, thread_config config){
+        if (auto applied = apply_thread_config(config); !applied.has_value()){
+            log::sync().warn("{}\n", applied.error());
+        }
+        current = &w;
+        while (!st.stop_requested()){
+            if (auto h = next(w)){
+                h->resume();
+                continue;
+            }
+
+            auto seen = epoch.load(std::memory_order_acquire);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // anything dispatched before we counted ourselves is found here
+            auto h = search(w);
+            if (!h && !st.stop_requested()){
+                epoch.wait(seen, std::memory_order_acquire);
+            }
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (h) h->resume();
+        }
+        current = nullptr;
+    }
+
+    thread_pool_impl::thread_pool_impl(const pool_config& config) : injected_count{0}, epoch{0}, sleepers{0} {
+        auto worker_count = config.workers != 0 ? config.workers : hardware_threads();
         workers.reserve(worker_count);
-        for(size_t i = 0; i < worker_count; ++i){
-            workers.emplace_back([this](std::stop_token st){
-                this->worker(st);
+        for (size_t i = 0; i < worker_count; ++i){
+            workers.push_back(std::make_unique<worker_t>(this, static_cast<uint32_t>(i) * 0x9e3779b9u + 1));
+        }
+        threads.reserve(worker_count);
+        for (size_t i = 0; i < worker_count; ++i){
+            thread_config t{std::format("{}-{}", config.name, i), {}};
+            if (!config.cpus.empty()) t.cpus.push_back(config.cpus[i % config.cpus.size()]);
+            threads.emplace_back([this, &w = *workers[i], t = std::move(t)](std::stop_token st){
+                this->worker(st, w, std::move(t));
             });
         }
     }
 
     thread_pool_impl::~thread_pool_impl() {
-        for (auto& worker : workers) {
-            worker.request_stop();
+        for (auto& t : threads) {
+            t.request_stop();
         }
-        sem.release(workers.size());
+        epoch.fetch_add(1, std::memory_order_release);
+        epoch.notify_all();
+        // joined before the queues they read go away
+        threads.clear();
     }
 
 
 
-}
\ No newline at end of file
+}
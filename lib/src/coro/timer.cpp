@@ -2,48 +2,80 @@
 
 namespace seele::coro::timer {
 
-    void timer_impl::worker(std::stop_token st){
+    template <typename clock_t>
+    void timer_impl<clock_t>::worker(std::stop_token st) requires (!manual_clock<clock_t>){
         using std::chrono_literals::operator""ms; 
-        
+
+        // expired together and dispatched after the lock is released
+        std::vector<std::coroutine_handle<>> due;
         while(!st.stop_requested()){
             std::unique_lock lock{m};
-            if(tasks.empty()){
-                cv.wait_until(lock, std::chrono::steady_clock::now() + 100ms, [&]{
-                    return !tasks.empty() || st.stop_requested();
-                });
-                continue;
+            auto now = ticks(clock_t::now());
+            while (auto h = wheel.pop(now)){
+                due.push_back(*h);
             }
 
-            auto t = tasks.begin();
-            auto due = t->first;
-            if (t->first > std::chrono::steady_clock::now()){
-                cv.wait_until(lock, due, [&]{
-                    return tasks.begin()->first <= std::chrono::steady_clock::now() || st.stop_requested();
+            if (due.empty()){
+                // the next slot may only be a level boundary, the wheel
+                // cascades there and this waits again
+                auto next = wheel.next_expiration();
+                auto until = next.has_value() ? time_point_of(next.value()) : clock_t::now() + 100ms;
+                rearm = false;
+                cv.wait_until(lock, until, [&]{
+                    return st.stop_requested() || rearm;
                 });
                 continue;
             }
+            lock.unlock();
 
-            auto task = t->second;
-            tasks.erase(t);
+            for (auto h : due){
+                seele::coro::thread::dispatch(h);
+            }
+            due.clear();
+        }
+    }
 
-            task.async_run();   
+    template <typename clock_t>
+    size_t timer_impl<clock_t>::run_due() requires manual_clock<clock_t>{
+        size_t count = 0;
+        while (true){
+            std::unique_lock lock{m};
+            auto h = wheel.pop(ticks(clock_t::now()));
+            if (!h.has_value()){
+                return count;
+            }
             lock.unlock();
 
+            h->resume();
+            count++;
         }
     }
 
+    template <typename clock_t>
+    bool timer_impl<clock_t>::advance_to_next() requires manual_clock<clock_t>{
+        std::unique_lock lock{m};
+        auto due = wheel.earliest();
+        if (!due.has_value()){
+            return false;
+        }
+        lock.unlock();
 
-    bool timer_impl::cancel(std::coroutine_handle<> handle){
-        std::lock_guard lock{m};
+        clock_t::advance_to(time_point_of(due.value()));
+        run_due();
+        return true;
+    }
 
-        for (auto& it : tasks){
-            if (it.second.handle == handle){
-                tasks.erase(it.first);
-                seele::log::sync().info("cancelling task: {}\n", math::tohex(handle.address()));
-                return true;
-            }
+
+    template <typename clock_t>
+    bool timer_impl<clock_t>::cancel(timer_id id){
+        std::lock_guard lock{m};
+        if (!wheel.erase(id)){
+            return false;
         }
-        
-        return false;
+        seele::log::sync().info("cancelling timer: {}\n", id.index);
+        return true;
     }
-}
\ No newline at end of file
+
+    template class timer_impl<std::chrono::steady_clock>;
+    template class timer_impl<virtual_clock>;
+}
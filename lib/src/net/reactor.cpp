@@ -0,0 +1,247 @@
+#include "net/reactor.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace seele::net{
+    namespace {
+        uint64_t steady_ticks(std::chrono::steady_clock::time_point tp){
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+            return ns < 0 ? 0 : static_cast<uint64_t>(ns);
+        }
+    }
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <winsock2.h>
+#include <system_error>
+namespace seele::net{
+
+    reactor::reactor(thread_config config) : armed{UINT64_MAX}, source{&reactor::cancel_of, this} {
+        thread = std::jthread{
+            [this, config = std::move(config)](std::stop_token st){
+                if (auto applied = apply_thread_config(config); !applied.has_value()){
+                    seele::log::sync().warn("{}\n", applied.error());
+                }
+                this->worker(st);
+            }
+        };
+    }
+
+    reactor::~reactor(){
+        thread.request_stop();
+        if (thread.joinable()) thread.join();
+    }
+
+    bool reactor::add(socket_t fd, handler_t handler){
+        std::lock_guard lock{m};
+        return handlers.try_emplace(fd, std::move(handler)).second;
+    }
+
+    void reactor::remove(socket_t fd){
+        std::lock_guard lock{m};
+        handlers.erase(fd);
+    }
+
+    // the timeout of the next poll does it
+    void reactor::arm(uint64_t when){
+        armed = when;
+    }
+
+    // WSAPoll has no registry of its own, the set is rebuilt every round and
+    // sockets added meanwhile are picked up within one timeout, so are timers
+    // due sooner than the one the poll waits for
+    void reactor::worker(std::stop_token st){
+        std::vector<WSAPOLLFD> fds;
+        while (!st.stop_requested()){
+            fds.clear();
+            {
+                std::lock_guard lock{m};
+                for (auto& [fd, _] : handlers){
+                    fds.push_back(WSAPOLLFD{static_cast<SOCKET>(fd), POLLRDNORM, 0});
+                }
+            }
+            int timeout = 100;
+            {
+                std::lock_guard lock{timer_m};
+                if (armed != UINT64_MAX){
+                    auto now = steady_ticks(std::chrono::steady_clock::now());
+                    timeout = armed <= now ? 0 : static_cast<int>(std::min<uint64_t>(100, (armed - now + 999999) / 1000000));
+                }
+            }
+
+            if (fds.empty()){
+                std::this_thread::sleep_for(std::chrono::milliseconds{timeout});
+                expire();
+                continue;
+            }
+
+            int n = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeout);
+            if (n == SOCKET_ERROR){
+                seele::log::sync().error("WSAPoll() failed: {}\n", std::system_error(WSAGetLastError(), std::system_category()).what());
+                std::this_thread::sleep_for(std::chrono::milliseconds{100});
+                continue;
+            }
+
+            {
+                std::lock_guard lock{m};
+                for (auto& p : fds){
+                    if (p.revents == 0) continue;
+                    // removed since the set was built
+                    if (auto it = handlers.find(p.fd); it != handlers.end()) it->second();
+                }
+            }
+            expire();
+        }
+    }
+}
+
+#elif defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+namespace seele::net{
+
+    reactor::reactor(thread_config config)
+        : armed{UINT64_MAX}, epfd{epoll_create1(EPOLL_CLOEXEC)}, tfd{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)}, source{&reactor::cancel_of, this} {
+        if (epfd == -1 || tfd == -1){
+            seele::log::sync().error("{}() failed: {}\n", epfd == -1 ? "epoll_create1" : "timerfd_create", strerror(errno));
+            std::exit(1);
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = tfd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) == -1){
+            seele::log::sync().error("epoll_ctl() failed: {}\n", strerror(errno));
+            std::exit(1);
+        }
+        thread = std::jthread{
+            [this, config = std::move(config)](std::stop_token st){
+                if (auto applied = apply_thread_config(config); !applied.has_value()){
+                    seele::log::sync().warn("{}\n", applied.error());
+                }
+                this->worker(st);
+            }
+        };
+    }
+
+    reactor::~reactor(){
+        thread.request_stop();
+        if (thread.joinable()) thread.join();
+        close(tfd);
+        close(epfd);
+    }
+
+    bool reactor::add(socket_t fd, handler_t handler){
+        std::lock_guard lock{m};
+        if (!handlers.try_emplace(fd, std::move(handler)).second) return false;
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1){
+            seele::log::sync().error("epoll_ctl() failed: {}\n", strerror(errno));
+            handlers.erase(fd);
+            return false;
+        }
+        return true;
+    }
+
+    void reactor::remove(socket_t fd){
+        std::lock_guard lock{m};
+        if (handlers.erase(fd) != 0) epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    // CLOCK_MONOTONIC is what steady_clock reads
+    void reactor::arm(uint64_t when){
+        if (when == armed) return;
+        armed = when;
+        itimerspec spec{};
+        if (when != UINT64_MAX){
+            // zero would disarm it
+            when = std::max<uint64_t>(when, 1);
+            spec.it_value.tv_sec = static_cast<time_t>(when / 1000000000);
+            spec.it_value.tv_nsec = static_cast<long>(when % 1000000000);
+        }
+        if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1){
+            seele::log::sync().error("timerfd_settime() failed: {}\n", strerror(errno));
+        }
+    }
+
+    void reactor::worker(std::stop_token st){
+        constexpr int max_events = 64;
+        epoll_event events[max_events];
+        while (!st.stop_requested()){
+            int n = epoll_wait(epfd, events, max_events, 100);
+            if (n == -1){
+                if (errno != EINTR) seele::log::sync().error("epoll_wait() failed: {}\n", strerror(errno));
+                continue;
+            }
+
+            bool fired = false;
+            {
+                std::lock_guard lock{m};
+                for (int i = 0; i < n; i++){
+                    if (events[i].data.fd == tfd){
+                        fired = true;
+                        continue;
+                    }
+                    // events are looked up by fd, a socket removed after
+                    // epoll_wait returned is simply not found
+                    if (auto it = handlers.find(events[i].data.fd); it != handlers.end()) it->second();
+                }
+            }
+            if (fired){
+                uint64_t expirations;
+                [[maybe_unused]] auto _ = read(tfd, &expirations, sizeof(expirations));
+                expire();
+            }
+        }
+    }
+}
+#endif
+
+namespace seele::net{
+    size_t reactor::size(){
+        std::lock_guard lock{m};
+        return handlers.size();
+    }
+
+    coro::timer::timer_id reactor::schedule(duration_t delay, std::coroutine_handle<> handle, std::atomic<coro::timer::timer_id>* id){
+        std::lock_guard lock{timer_m};
+        auto when = steady_ticks(std::chrono::steady_clock::now() + delay);
+        auto submitted = wheel.insert(when, handle);
+        if (id != nullptr) id->store(submitted, std::memory_order_release);
+        if (when < armed) arm(when);
+        return submitted;
+    }
+
+    bool reactor::cancel(coro::timer::timer_id id){
+        std::lock_guard lock{timer_m};
+        return wheel.erase(id);
+    }
+
+    bool reactor::cancel_of(void* owner, coro::timer::timer_id id){
+        return static_cast<reactor*>(owner)->cancel(id);
+    }
+
+    void reactor::expire(){
+        {
+            std::lock_guard lock{timer_m};
+            auto now = steady_ticks(std::chrono::steady_clock::now());
+            while (auto h = wheel.pop(now)){
+                due.push_back(*h);
+            }
+            // a lower bound at times, going off early only pops nothing
+            arm(wheel.next_expiration().value_or(UINT64_MAX));
+        }
+        for (auto h : due){
+            h.resume();
+        }
+        due.clear();
+    }
+}
@@ -37,6 +37,32 @@ namespace seele::net{
         WSACleanup();
     }
 
+    udpv4::udpv4(udpv4&& other){
+        socketfd = other.socketfd;
+        other.socketfd = INVALID_SOCKET;
+    }
+
+    udpv4& udpv4::operator=(udpv4&& other){
+        if (this != &other){
+            if (socketfd != INVALID_SOCKET)
+                closesocket(socketfd);
+            socketfd = other.socketfd;
+            other.socketfd = INVALID_SOCKET;
+        }
+        return *this;
+    }
+
+    std::expected<udpv4, udpv4_error> udpv4::open(ipv4 local){
+        socket_t fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == INVALID_SOCKET) {
+            seele::log::sync().error("socket() failed: {}\n", std::system_error(WSAGetLastError(), std::system_category()).what());
+            return std::unexpected{udpv4_error::SOCKET_ERROR};
+        }
+        udpv4 sock{fd};
+        if (!sock.bind(local)) return std::unexpected{udpv4_error::BIND_ERROR};
+        return sock;
+    }
+
 
     bool udpv4::bind(ipv4 info){
         sockaddr_in local{};
@@ -60,11 +86,22 @@ namespace seele::net{
         }
         return true;
     }
+    bool udpv4::set_nonblocking(){
+        u_long mode = 1;
+        if (ioctlsocket(socketfd, FIONBIO, &mode) != 0){
+            seele::log::sync().error("ioctlsocket() failed: {}\n", std::system_error(WSAGetLastError(), std::system_category()).what());
+            return false;
+        }
+        return true;
+    }
     std::expected<size_t, udpv4_error> udpv4::recvfrom(ipv4& src, void* buffer, size_t buffer_size){
         sockaddr_in src_addr;
         socklen_t src_addr_len = sizeof(src_addr);
         auto recv_size = ::recvfrom(socketfd, reinterpret_cast<char*>(buffer), buffer_size, 0, reinterpret_cast<sockaddr*>(&src_addr), &src_addr_len);
         if (recv_size == -1){
+            if (auto e = WSAGetLastError(); e == WSAETIMEDOUT || e == WSAEWOULDBLOCK){
+                return std::unexpected{udpv4_error::TIMEOUT_ERROR};
+            }
             seele::log::sync().error("recvfrom() failed: {}\n", std::system_error(WSAGetLastError(), std::system_category()).what());
             return std::unexpected{udpv4_error::RECVFROM_ERROR};
         }
@@ -176,6 +213,12 @@ namespace seele::net{
         free(pAddresses);
         return res;
     }
+
+    uint32_t query_default_gateway(){
+        MIB_IPFORWARDROW row{};
+        if (GetBestRoute(0, 0, &row) != NO_ERROR) return 0;
+        return row.dwForwardNextHop;
+    }
 }
 
 
@@ -187,8 +230,11 @@ namespace seele::net{
     #include <sys/socket.h>
     #include <netinet/in.h>
     #include <unistd.h>
+    #include <fcntl.h>
     #include <ifaddrs.h>
     #include <net/if.h>
+    #include <net/route.h>
+    #include <cstdio>
 
 namespace seele::net{
     udpv4::udpv4(){
@@ -204,6 +250,17 @@ namespace seele::net{
         other.socketfd = -1;
     }
 
+    std::expected<udpv4, udpv4_error> udpv4::open(ipv4 local){
+        socket_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd == -1){
+            seele::log::sync().error("socket() failed: {}\n", strerror(errno));
+            return std::unexpected{udpv4_error::SOCKET_ERROR};
+        }
+        udpv4 sock{fd};
+        if (!sock.bind(local)) return std::unexpected{udpv4_error::BIND_ERROR};
+        return sock;
+    }
+
     udpv4& udpv4::operator=(udpv4&& other){
         if (this != &other){
             if (socketfd != -1)
@@ -241,11 +298,22 @@ namespace seele::net{
         }
         return true;
     }
+    bool udpv4::set_nonblocking(){
+        int flags = fcntl(socketfd, F_GETFL, 0);
+        if (flags == -1 || fcntl(socketfd, F_SETFL, flags | O_NONBLOCK) == -1){
+            seele::log::sync().error("fcntl() failed: {}\n", strerror(errno));
+            return false;
+        }
+        return true;
+    }
     std::expected<size_t, udpv4_error> udpv4::recvfrom(ipv4& src, void* buffer, size_t buffer_size){
         sockaddr_in src_addr;
         socklen_t src_addr_len = sizeof(src_addr);
         ssize_t recv_size = ::recvfrom(socketfd, buffer, buffer_size, 0, reinterpret_cast<sockaddr*>(&src_addr), &src_addr_len);
         if (recv_size == -1){
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                return std::unexpected{udpv4_error::TIMEOUT_ERROR};
+            }
             seele::log::sync().error("recvfrom() failed: {}\n", strerror(errno));
             return std::unexpected{udpv4_error::RECVFROM_ERROR};
         }
@@ -319,6 +387,23 @@ namespace seele::net{
         return res;
     }
 
-
+    uint32_t query_default_gateway(){
+        FILE* f = fopen("/proc/net/route", "r");
+        if (f == nullptr) return 0;
+
+        // columns are printed from the raw network order words
+        char line[256];
+        uint32_t res = 0, best_metric = UINT32_MAX;
+        while (fgets(line, sizeof(line), f) != nullptr){
+            char iface[IFNAMSIZ + 1];
+            unsigned int dest, gateway, flags, refcnt, use, metric, mask;
+            if (sscanf(line, "%16s %x %x %x %u %u %u %x", iface, &dest, &gateway, &flags, &refcnt, &use, &metric, &mask) != 8) continue;
+            if (dest != 0 || mask != 0 || !(flags & RTF_GATEWAY) || metric >= best_metric) continue;
+            res = gateway;
+            best_metric = metric;
+        }
+        fclose(f);
+        return res;
+    }
 }
 #endif
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <thread>
+
+#include "thread_config.h"
+#include "math.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace seele {
+
+    namespace {
+        // far more than any machine has, a typo should not fill memory
+        constexpr uint32_t max_cpus = 65536;
+    }
+
+    #if defined(_WIN32) || defined(_WIN64)
+    std::expected<void, std::string> apply_thread_config(const thread_config& config){
+        if (!config.name.empty()){
+            std::wstring name(config.name.begin(), config.name.end());
+            SetThreadDescription(GetCurrentThread(), name.c_str());
+        }
+        if (config.cpus.empty()) return {};
+
+        DWORD_PTR mask = 0;
+        for (auto cpu : config.cpus){
+            if (cpu >= sizeof(DWORD_PTR) * 8){
+                return std::unexpected(std::format("cpu {} is outside the thread's processor group", cpu));
+            }
+            mask |= DWORD_PTR{1} << cpu;
+        }
+        if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0){
+            return std::unexpected(std::format("SetThreadAffinityMask() failed: {}", GetLastError()));
+        }
+        return {};
+    }
+    #elif defined(__linux__)
+    std::expected<void, std::string> apply_thread_config(const thread_config& config){
+        if (!config.name.empty()){
+            auto name = config.name.substr(0, 15);
+            pthread_setname_np(pthread_self(), name.c_str());
+        }
+        if (config.cpus.empty()) return {};
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : config.cpus){
+            if (cpu >= CPU_SETSIZE) return std::unexpected(std::format("cpu {} is out of range", cpu));
+            CPU_SET(cpu, &set);
+        }
+        if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); err != 0){
+            return std::unexpected(std::format("failed to set the affinity of {}: {}", config.name, strerror(err)));
+        }
+        return {};
+    }
+    #else
+    std::expected<void, std::string> apply_thread_config(const thread_config& config){
+        if (config.cpus.empty()) return {};
+        return std::unexpected("thread affinity is not supported on this platform");
+    }
+    #endif
+
+    std::expected<std::vector<unsigned>, std::string> parse_cpu_list(std::string_view list){
+        std::vector<unsigned> cpus;
+        while (!list.empty()){
+            auto comma = list.find(',');
+            auto item = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+            auto dash = item.find('-');
+            auto first = math::stoi(item.substr(0, dash));
+            auto last = dash == std::string_view::npos ? first : math::stoi(item.substr(dash + 1));
+            if (!first.has_value() || !last.has_value() || last.value() < first.value() || last.value() >= max_cpus){
+                return std::unexpected(std::format("invalid cpu range: {}", item));
+            }
+            for (auto cpu = first.value(); cpu <= last.value(); cpu++){
+                cpus.push_back(cpu);
+            }
+        }
+        if (cpus.empty()) return std::unexpected("empty cpu list");
+
+        std::ranges::sort(cpus);
+        auto [end, _] = std::ranges::unique(cpus);
+        cpus.erase(end, cpus.end());
+        return cpus;
+    }
+
+    size_t hardware_threads(){
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+}
@@ -0,0 +1,189 @@
+#include <algorithm>
+
+#include "binding_manager.h"
+#include "log.h"
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+    uint64_t pack(const net::ipv4& addr){
+        return (static_cast<uint64_t>(addr.net_address) << 16) | addr.net_port | (uint64_t{1} << 48);
+    }
+
+    std::optional<net::ipv4> unpack(uint64_t v){
+        if (v == 0) return std::nullopt;
+        return net::ipv4{static_cast<uint32_t>(v >> 16), static_cast<uint16_t>(v)};
+    }
+
+    // every binding is a descriptor, the default soft limit is usually 1024
+    void raise_fd_limit(){
+        #if defined(__linux__)
+        rlimit rl{};
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max){
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        #endif
+    }
+}
+
+binding_manager::binding_manager(net::ipv4 server, uint32_t bind_address, keepalive_params params)
+    : server{server}, bind_address{bind_address}, params{params},
+      txns{std::make_shared<client_udpv4::txn_manager>()}, outstanding{0} {
+    raise_fd_limit();
+}
+
+binding_manager::~binding_manager(){
+    std::vector<std::unique_ptr<binding>> closing;
+    {
+        std::lock_guard lock{m};
+        closing.swap(bindings);
+    }
+    // everything is stopped first, so in-flight refreshes are abandoned together
+    std::vector<binding*> running;
+    for (auto& b : closing){
+        if (b && stop(*b)) running.push_back(b.get());
+    }
+    for (auto b : running){
+        b->keepalive->wait();
+    }
+}
+
+std::chrono::milliseconds binding_manager::jittered(std::chrono::milliseconds base) const{
+    auto lo = static_cast<int64_t>(base.count() * params.low);
+    auto hi = std::max(lo + 1, static_cast<int64_t>(base.count() * params.high));
+    return std::chrono::milliseconds{math::random<int64_t>(lo, hi)};
+}
+
+coro::timer::delay_task binding_manager::keepalive(binding_id id, binding& b){
+    std::chrono::milliseconds wait{0};
+    while (true){
+        co_await coro::timer::delay_awaiter{wait};
+        if (b.stopped.load()) co_return;
+
+        if (outstanding.fetch_add(1) >= params.max_outstanding){
+            outstanding.fetch_sub(1);
+            wait = jittered(std::chrono::milliseconds{100});
+            continue;
+        }
+
+        stun::message msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+        b.pending = msg.get_txn_id();
+        auto req = b.client.async_req(server, msg);
+        b.in_flight.store(true);
+        // stop() may have looked before in_flight was set
+        if (b.stopped.load()) txns->onTimeout(b.pending);
+
+        auto res = co_await std::move(req);
+        b.in_flight.store(false);
+        outstanding.fetch_sub(1);
+        if (b.stopped.load()) co_return;
+
+        auto x_addr = res.has_value() ? std::get<1>(res.value()).find_one<stun::ipv4_xor_mappedAddress>() : nullptr;
+        if (x_addr == nullptr){
+            auto failures = b.failures.fetch_add(1) + 1;
+            log::async().warn("binding {} refresh failed ({} in a row): {}\n",
+                b.client.get_self_addr().toString(), failures, res.has_value() ? "no mapped address" : res.error());
+            wait = std::min(jittered(params.retry), jittered(params.lifetime));
+            continue;
+        }
+
+        net::ipv4 now{x_addr->get_net_address(), x_addr->get_net_port()};
+        b.failures.store(0);
+        b.refreshed.store(std::chrono::steady_clock::now().time_since_epoch().count());
+        if (auto previous = unpack(b.mapped.exchange(pack(now))); previous != now){
+            if (previous.has_value()){
+                b.changes.fetch_add(1);
+                log::async().warn("binding {} moved from {} to {}\n", b.client.get_self_addr().toString(), previous->toString(), now.toString());
+            }
+            if (on_change) on_change(id, previous, now);
+        }
+        wait = jittered(params.lifetime);
+    }
+}
+
+bool binding_manager::stop(binding& b){
+    b.stopped.store(true);
+    if (b.in_flight.load()) txns->onTimeout(b.pending);
+    return !b.keepalive->cancel();
+}
+
+std::expected<binding_manager::binding_id, std::string> binding_manager::open(){
+    // random ports collide now and then once there are thousands of them
+    constexpr int attempts = 8;
+    std::expected<net::udpv4, net::udpv4_error> socket = std::unexpected(net::udpv4_error::BIND_ERROR);
+    net::ipv4 local{bind_address, 0};
+    for (int i = 0; i < attempts && !socket.has_value(); i++){
+        local.net_port = net::random_pri_iana_net_port();
+        socket = net::udpv4::open(local);
+    }
+    if (!socket.has_value()){
+        return std::unexpected(std::format("failed to bind a port on {}", net::inet_ntoa(bind_address)));
+    }
+
+    std::lock_guard lock{m};
+    binding_id id = bindings.size();
+    auto& b = bindings.emplace_back(std::make_unique<binding>(std::move(socket.value()), local, txns, &reactor));
+    b->keepalive.emplace(keepalive(id, *b));
+    return id;
+}
+
+std::unique_ptr<binding_manager::binding> binding_manager::detach(binding_id id){
+    std::unique_ptr<binding> b;
+    {
+        std::lock_guard lock{m};
+        if (id >= bindings.size() || !bindings[id]) return nullptr;
+        b = std::move(bindings[id]);
+    }
+    if (stop(*b)){
+        b->keepalive->wait();
+    }
+    return b;
+}
+
+void binding_manager::close(binding_id id){
+    detach(id);
+}
+
+bool binding_manager::hand_off(binding_id id, const handoff_t& handoff){
+    auto b = detach(id);
+    if (!b) return false;
+    b->client.stop_receiving();
+    handoff(b->client.get_socket(), info_of(*b));
+    return true;
+}
+
+binding_manager::binding_info binding_manager::info_of(binding& b){
+    std::optional<std::chrono::steady_clock::time_point> refreshed;
+    if (auto ticks = b.refreshed.load(); ticks != 0){
+        refreshed = std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{ticks}};
+    }
+    return binding_info{b.client.get_self_addr(), unpack(b.mapped.load()), b.changes.load(), b.failures.load(), refreshed};
+}
+
+std::optional<binding_manager::binding_info> binding_manager::info(binding_id id){
+    std::lock_guard lock{m};
+    if (id >= bindings.size() || !bindings[id]) return std::nullopt;
+    return info_of(*bindings[id]);
+}
+
+std::optional<net::ipv4> binding_manager::mapped(binding_id id){
+    std::lock_guard lock{m};
+    if (id >= bindings.size() || !bindings[id]) return std::nullopt;
+    return unpack(bindings[id]->mapped.load());
+}
+
+binding_manager::totals_t binding_manager::totals(){
+    std::lock_guard lock{m};
+    totals_t t{0, 0, 0, 0};
+    for (auto& b : bindings){
+        if (!b) continue;
+        t.bindings++;
+        if (b->mapped.load() != 0) t.mapped++;
+        t.changes += b->changes.load();
+        if (b->failures.load() != 0) t.failing++;
+    }
+    return t;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "client.h"
+#include "net/reactor.h"
+
+struct keepalive_params
+{
+    // binding lifetime, e.g. as measured by lifetime_test
+    std::chrono::seconds lifetime{30};
+    // each refresh is drawn uniformly from [low, high] of the lifetime, so
+    // bindings opened together drift apart instead of refreshing together
+    double low = 0.6;
+    double high = 0.8;
+    // wait after a failed refresh, jittered the same way
+    std::chrono::seconds retry{5};
+    // requests in flight at once, well under the txn table's capacity
+    size_t max_outstanding = 1024;
+};
+
+// Many bindings to one server, kept open by refreshing each of them before
+// its lifetime runs out. All sockets share one reactor thread and one txn
+// manager; a binding costs a socket, its client and a keepalive coroutine
+// waiting on the timer.
+class binding_manager{
+public:
+    using binding_id = size_t;
+    // runs on a pool thread inside the binding's refresh, so it must not
+    // close that binding (other ones are fine); previous is empty for the
+    // first answer
+    using change_handler = std::function<void(binding_id, std::optional<net::ipv4> previous, net::ipv4 mapped)>;
+
+    struct binding_info{
+        net::ipv4 local;
+        std::optional<net::ipv4> mapped;
+        uint32_t changes;
+        uint32_t failures;
+        // the last answer, empty before the first one
+        std::optional<std::chrono::steady_clock::time_point> refreshed;
+    };
+
+    // gets the socket of a binding that is neither refreshed nor received on
+    // any more; the binding is closed once it returns
+    using handoff_t = std::function<void(const net::udpv4& socket, const binding_info& info)>;
+
+    struct totals_t{
+        size_t bindings;
+        size_t mapped;
+        uint64_t changes;
+        uint64_t failing;
+    };
+
+private:
+    struct binding{
+        client_udpv4 client;
+        std::optional<coro::timer::delay_task> keepalive;
+        // 0 until the first answer
+        std::atomic<uint64_t> mapped{0};
+        std::atomic<uint32_t> changes{0};
+        // consecutive, reset by an answer
+        std::atomic<uint32_t> failures{0};
+        // steady_clock ticks of the last answer, 0 before the first one
+        std::atomic<int64_t> refreshed{0};
+        std::atomic<bool> stopped{false};
+        // pending is only read by close() while in_flight is set
+        std::atomic<bool> in_flight{false};
+        stun::txn_id_t pending;
+
+        binding(net::udpv4&& socket, net::ipv4 local, std::shared_ptr<client_udpv4::txn_manager> txns, net::reactor* reactor)
+            : client{std::move(socket), local, std::move(txns), reactor} {}
+    };
+
+    net::ipv4 server;
+    uint32_t bind_address;
+    keepalive_params params;
+    change_handler on_change;
+
+    // declared first, destroyed after every client on it
+    net::reactor reactor;
+    std::shared_ptr<client_udpv4::txn_manager> txns;
+    std::atomic<size_t> outstanding;
+
+    std::mutex m;
+    // indexed by binding_id, closed ones are left empty
+    std::vector<std::unique_ptr<binding>> bindings;
+
+    coro::timer::delay_task keepalive(binding_id id, binding& b);
+    std::chrono::milliseconds jittered(std::chrono::milliseconds base) const;
+    // stops the keepalive, true if it has to be waited for
+    bool stop(binding& b);
+    // takes id out of the table and waits for its keepalive to stop
+    std::unique_ptr<binding> detach(binding_id id);
+    static binding_info info_of(binding& b);
+
+public:
+    explicit binding_manager(net::ipv4 server, uint32_t bind_address, keepalive_params params = {});
+    binding_manager(const binding_manager&) = delete;
+    binding_manager& operator=(const binding_manager&) = delete;
+    ~binding_manager();
+
+    // set before the first open()
+    inline void set_on_change(change_handler handler){ on_change = std::move(handler); }
+
+    // binds a socket and starts refreshing it, the first Binding request
+    // goes out right away
+    std::expected<binding_id, std::string> open();
+    // waits for a refresh in flight to be abandoned, on a pool thread by
+    // running other coroutines meanwhile
+    void close(binding_id id);
+    // closes id after handing its socket to handoff, e.g. to pass the
+    // descriptor to another process; false if there is no such binding
+    bool hand_off(binding_id id, const handoff_t& handoff);
+
+    std::optional<binding_info> info(binding_id id);
+    std::optional<net::ipv4> mapped(binding_id id);
+    totals_t totals();
+};
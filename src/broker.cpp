@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+
+#include "broker.h"
+#include "log.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    uint32_t to_ms(std::chrono::steady_clock::duration d){
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+        return static_cast<uint32_t>(std::clamp<int64_t>(ms, 0, UINT32_MAX));
+    }
+
+    #if defined(__linux__)
+    std::expected<sockaddr_un, std::string> unix_address(std::string_view path){
+        sockaddr_un addr{};
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)){
+            return std::unexpected(std::format("invalid broker socket path: {}", path));
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.data(), path.size());
+        return addr;
+    }
+
+    // the lease and, unless it says otherwise, the descriptor in one message
+    bool send_lease(int conn, const broker_lease& lease, int fd){
+        iovec iov{const_cast<broker_lease*>(&lease), sizeof(lease)};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        if (fd != -1){
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            auto cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+        return sendmsg(conn, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(lease));
+    }
+    #endif
+}
+
+binding_broker::binding_broker(net::ipv4 server, uint32_t bind_address, std::string path, broker_params params)
+    : path{std::move(path)}, params{params}, manager{server, bind_address, params.keepalive}, leased{0}, listen_fd{-1} {}
+
+binding_broker::~binding_broker(){
+    worker.request_stop();
+    if (worker.joinable()) worker.join();
+    #if defined(__linux__)
+    if (listen_fd != -1){
+        ::close(listen_fd);
+        ::unlink(path.c_str());
+    }
+    #endif
+}
+
+void binding_broker::refill(){
+    auto id = manager.open();
+    if (!id.has_value()){
+        log::async().warn("broker pool short of a binding: {}\n", id.error());
+        return;
+    }
+    std::lock_guard lock{m};
+    pool.push_back(id.value());
+}
+
+#if defined(__linux__)
+std::expected<void, std::string> binding_broker::start(){
+    auto addr = unix_address(path);
+    if (!addr.has_value()) return std::unexpected(addr.error());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return std::unexpected(std::format("socket() failed: {}", strerror(errno)));
+
+    // a socket left behind by a broker that died is replaced, a live one is not
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr.value()), sizeof(sockaddr_un)) == 0){
+        ::close(fd);
+        return std::unexpected(std::format("a broker is already listening at {}", path));
+    }
+    ::close(fd);
+    ::unlink(path.c_str());
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return std::unexpected(std::format("socket() failed: {}", strerror(errno)));
+    // the sockets are as good as the user's own, so the path is created
+    // 0600 rather than narrowed after the fact
+    auto old_mask = ::umask(0177);
+    auto bound = ::bind(fd, reinterpret_cast<sockaddr*>(&addr.value()), sizeof(sockaddr_un));
+    ::umask(old_mask);
+    if (bound == -1){
+        auto err = std::format("failed to bind {}: {}", path, strerror(errno));
+        ::close(fd);
+        return std::unexpected(err);
+    }
+    if (::chmod(path.c_str(), 0600) == -1){
+        auto err = std::format("failed to restrict {}: {}", path, strerror(errno));
+        ::close(fd);
+        ::unlink(path.c_str());
+        return std::unexpected(err);
+    }
+    if (::listen(fd, 64) == -1){
+        auto err = std::format("failed to listen on {}: {}", path, strerror(errno));
+        ::close(fd);
+        ::unlink(path.c_str());
+        return std::unexpected(err);
+    }
+    listen_fd = fd;
+
+    for (size_t i = 0; i < params.pool; i++) refill();
+    worker = std::jthread{[this](std::stop_token st){ serve(st); }};
+    return {};
+}
+
+void binding_broker::serve(std::stop_token st){
+    while (!st.stop_requested()){
+        pollfd p{listen_fd, POLLIN, 0};
+        if (::poll(&p, 1, 100) <= 0) continue;
+
+        int conn = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn == -1) continue;
+        lease(conn);
+        ::close(conn);
+    }
+}
+
+void binding_broker::lease(int conn){
+    // the most recently refreshed has the longest until it expires
+    std::optional<binding_manager::binding_id> best;
+    std::chrono::steady_clock::time_point best_refreshed{};
+    {
+        std::lock_guard lock{m};
+        for (auto id : pool){
+            auto info = manager.info(id);
+            if (!info.has_value() || !info->mapped.has_value() || info->failures != 0 || !info->refreshed.has_value()) continue;
+            if (!best.has_value() || info->refreshed.value() > best_refreshed){
+                best = id;
+                best_refreshed = info->refreshed.value();
+            }
+        }
+        if (best.has_value()) std::erase(pool, best.value());
+    }
+
+    if (!best.has_value()){
+        send_lease(conn, broker_lease{lease_none_ready, 0, 0, 0, 0, 0, 0}, -1);
+        return;
+    }
+
+    manager.hand_off(best.value(), [&](const net::udpv4& socket, const binding_manager::binding_info& info){
+        auto now = std::chrono::steady_clock::now();
+        broker_lease l{
+            lease_ok,
+            info.local.net_address, info.mapped->net_address,
+            info.local.net_port, info.mapped->net_port,
+            to_ms(params.keepalive.lifetime),
+            to_ms(now - info.refreshed.value_or(now))
+        };
+        if (!send_lease(conn, l, socket.native_handle())){
+            log::async().warn("failed to hand {} over: {}\n", info.local.toString(), strerror(errno));
+            return;
+        }
+        leased.fetch_add(1);
+        log::async().info("leased {} mapped to {}\n", info.local.toString(), info.mapped->toString());
+    });
+    refill();
+}
+
+std::expected<leased_socket, std::string> lease_socket(std::string_view path){
+    auto addr = unix_address(path);
+    if (!addr.has_value()) return std::unexpected(addr.error());
+
+    int conn = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn == -1) return std::unexpected(std::format("socket() failed: {}", strerror(errno)));
+    if (::connect(conn, reinterpret_cast<sockaddr*>(&addr.value()), sizeof(sockaddr_un)) == -1){
+        auto err = std::format("no broker at {}: {}", path, strerror(errno));
+        ::close(conn);
+        return std::unexpected(err);
+    }
+
+    broker_lease l{};
+    iovec iov{&l, sizeof(l)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto n = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    ::close(conn);
+
+    int fd = -1;
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    // owned from here on, so every failure below closes it
+    std::optional<net::udpv4> socket;
+    if (fd != -1) socket.emplace(net::udpv4::adopt(fd));
+
+    if (n != static_cast<ssize_t>(sizeof(l))){
+        return std::unexpected(std::format("short lease from {}", path));
+    }
+    if (l.status == lease_none_ready){
+        return std::unexpected("no binding is ready yet");
+    }
+    if (l.status != lease_ok || !socket.has_value()){
+        return std::unexpected(std::format("broker refused the lease: status {}", l.status));
+    }
+    return leased_socket{
+        std::move(socket.value()),
+        net::ipv4{l.local_address, l.local_port},
+        net::ipv4{l.mapped_address, l.mapped_port},
+        std::chrono::milliseconds{l.lifetime_ms},
+        std::chrono::milliseconds{l.refreshed_ms_ago}
+    };
+}
+#else
+std::expected<void, std::string> binding_broker::start(){
+    return std::unexpected("the broker needs Unix domain sockets");
+}
+
+void binding_broker::serve(std::stop_token){}
+void binding_broker::lease(int){}
+
+std::expected<leased_socket, std::string> lease_socket(std::string_view){
+    return std::unexpected("the broker needs Unix domain sockets");
+}
+#endif
+
+std::optional<std::string> default_broker_path(){
+    #if defined(__linux__)
+    if (auto dir = std::getenv("XDG_RUNTIME_DIR"); dir != nullptr && *dir != 0){
+        return std::format("{}/stun-client.sock", dir);
+    }
+    #endif
+    return std::nullopt;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "binding_manager.h"
+
+struct broker_params
+{
+    // bindings kept mapped and refreshed, waiting to be leased
+    size_t pool = 8;
+    keepalive_params keepalive{};
+};
+
+constexpr uint32_t lease_ok = 0;
+// every pooled binding is still waiting for its first answer or failing
+constexpr uint32_t lease_none_ready = 1;
+
+// One per connection, sent with the socket's descriptor when status is
+// lease_ok. Addresses and ports are in network byte order.
+struct broker_lease
+{
+    uint32_t status;
+    uint32_t local_address;
+    uint32_t mapped_address;
+    uint16_t local_port;
+    uint16_t mapped_port;
+    // the binding expires this long after its last refresh
+    uint32_t lifetime_ms;
+    uint32_t refreshed_ms_ago;
+};
+static_assert(sizeof(broker_lease) == 24);
+
+// A warm pool of bindings to one server, each socket handed out once to
+// whichever local process connects to the Unix socket at path. The
+// descriptor arrives non-blocking and from then on belongs to that process,
+// which has to refresh the binding itself; a leased binding is replaced
+// right away. Unix only, start() fails elsewhere.
+class binding_broker{
+private:
+    std::string path;
+    broker_params params;
+
+    binding_manager manager;
+
+    std::mutex m;
+    // opened by this broker and not leased yet
+    std::vector<binding_manager::binding_id> pool;
+    std::atomic<uint64_t> leased;
+
+    int listen_fd;
+    std::jthread worker;
+
+    void serve(std::stop_token st);
+    void lease(int conn);
+    void refill();
+
+public:
+    explicit binding_broker(net::ipv4 server, uint32_t bind_address, std::string path, broker_params params = {});
+    binding_broker(const binding_broker&) = delete;
+    binding_broker& operator=(const binding_broker&) = delete;
+    ~binding_broker();
+
+    // opens the pool and starts listening, replacing a stale socket at path
+    std::expected<void, std::string> start();
+
+    inline uint64_t get_leased() const { return leased.load(); }
+    inline binding_manager::totals_t totals() { return manager.totals(); }
+};
+
+struct leased_socket
+{
+    net::udpv4 socket;
+    net::ipv4 local;
+    net::ipv4 mapped;
+    std::chrono::milliseconds lifetime;
+    std::chrono::milliseconds refreshed_ago;
+};
+
+// takes one socket from the broker listening at path
+std::expected<leased_socket, std::string> lease_socket(std::string_view path);
+// $XDG_RUNTIME_DIR/stun-client.sock
+std::optional<std::string> default_broker_path();
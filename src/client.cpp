@@ -3,19 +3,38 @@
 
 
 
+bool client_udpv4::receive(){
+    constexpr size_t buffer_size = stun::max_message_size;
+    alignas(stun::header) std::byte buffer[buffer_size];
+    net::ipv4 ipinfo;
+    if (!udp.recvfrom(ipinfo, buffer, buffer_size).has_value()) return false;
+
+    // check validity
+    if (stun::message::is_valid(buffer)){
+        auto msg = stun::message{buffer};
+        seele::log::async().info("received from {}:{} to:{}\n{}", seele::net::inet_ntoa(ipinfo.net_address), math::ntoh(ipinfo.net_port), math::ntoh(self_addr.net_port), msg.toString());
+
+        // otherwise it may be one of ours coming back, as in the hairpinning test
+        if (msg.get_type() == (stun::msg_method::BINDING | stun::msg_type::REQUEST) && answering.load()){
+            answer(ipinfo, msg);
+            return true;
+        }
+        this->onResponse(std::move(ipinfo), std::move(msg));
+    }
+    return true;
+}
+
+// unpaced, there is one answer per request and the asking side paces those
+void client_udpv4::answer(const net::ipv4& ip, const stun::message& req){
+    stun::message res(stun::msg_method::BINDING | stun::msg_type::SUCCESS_RESPONSE);
+    res.set_txn_id(req.get_txn_id());
+    res.emplace<stun::ipv4_xor_mappedAddress>(ip.net_address, ip.net_port);
+    udp.sendto(ip, res.data_ptr(), res.size());
+}
+
 void client_udpv4::listener(std::stop_token st){
     while(!st.stop_requested()){
-        constexpr size_t buffer_size = 1024;
-        alignas(stun::header) std::byte buffer[buffer_size];
-        net::ipv4 ipinfo;
-        // check validity
-        if (udp.recvfrom(ipinfo, buffer, buffer_size).has_value() && stun::message::is_valid(buffer)){
-                            
-            auto msg = stun::message{buffer};
-            seele::log::async().info("received from {}:{} to:{}\n{}", seele::net::inet_ntoa(ipinfo.net_address), math::ntoh(ipinfo.net_port), math::ntoh(self_addr.net_port), msg.toString());
-
-            this->onResponse(std::move(ipinfo), std::move(msg));
-        }
+        receive();
     }
 }
 void client_udpv4::start_listener(){
@@ -27,19 +46,39 @@ void client_udpv4::start_listener(){
 }  
 
 
-seele::coro::timer::delay_task client_udpv4::request(const seele::net::ipv4& ip, const stun::message& msg){
-    using std::chrono_literals::operator""ms; 
-    constexpr uint64_t retry = 2;
-    constexpr std::chrono::milliseconds RTO = 500ms;
-    std::chrono::milliseconds delay = 0ms;
-    co_await seele::coro::timer::delay_awaiter{delay};
-    for (size_t i = 0; i < retry; i++){
+// With a reactor the schedule runs on its timer and thread; whoever
+// co_awaits the request continues on the pool, as with the shared timer.
+seele::coro::timer::delay_task client_udpv4::request(const seele::net::ipv4& ip, const stun::message& msg, transmissions<clock_t>& tx){
+    auto& params = tx.params;
+    bool timed_out = true;
+    for (uint32_t i = 0; i < params.Rc; i++){
+        // looked at before every wait and every send, an answer that came
+        // in as the last interval ended must not cost another one
+        if (tx.stopped.load()){
+            timed_out = false;
+            break;
+        }
+        // the first send always goes through the timer, so request() returns before it
+        if (auto wait = pace(); i == 0 || wait > clock_t::duration::zero()){
+            if (reactor != nullptr) co_await reactor->delay(wait);
+            else co_await seele::coro::timer::delay_awaiter{wait};
+            if (tx.stopped.load()){
+                timed_out = false;
+                break;
+            }
+        }
         udp.sendto(ip, msg.data_ptr(), msg.size());
+        tx.sent();
         seele::log::async().info("sending from:{} to {}:{} \n{}", math::ntoh(self_addr.net_port), seele::net::inet_ntoa(ip.net_address), math::ntoh(ip.net_port), msg.toString());
-        delay = delay*2 + RTO;
-        co_await seele::coro::timer::delay_awaiter{delay};
+        if (reactor != nullptr) co_await reactor->delay(params.interval(tx.rto, i));
+        else co_await seele::coro::timer::delay_awaiter{params.interval(tx.rto, i)};
     }
+    timed_out = timed_out && !tx.stopped.load();
 
-    this->onTimeout(msg.get_txn_id());
+    if (timed_out){
+        tx.exhausted.store(true);
+        this->onTimeout(msg.get_txn_id());
+    }
+    if (reactor != nullptr) co_await seele::coro::thread::dispatch_awaiter{};
     co_return;
 };
@@ -1,18 +1,122 @@
 #pragma once
 #include <cstddef>
 #include <cstdint>
-#include <map>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string_view>
 #include <tuple>
 #include <expected>
 
 #include "log.h"
+#include "pacer.h"
+#include "rto.h"
 #include "stun.h"
 #include "coro/timer.h"
+#include "net/reactor.h"
 #include "net/udpv4.h"
+#include "struct/sharded_table.h"
 using namespace seele;
+
+struct txn_stats{
+    std::atomic<uint64_t> registered{0};
+    std::atomic<uint64_t> responded{0};
+    std::atomic<uint64_t> timed_out{0};
+};
+
+// Process-wide view of txn_managers, for diagnostics only; nothing on the
+// request path goes through it. Managers created while it is disabled are
+// never listed, destroyed ones are folded into the totals.
+class txn_registry{
+private:
+    std::atomic<bool> enabled;
+    std::mutex m;
+public:
+    struct totals_t{
+        size_t managers;
+        uint64_t registered;
+        uint64_t responded;
+        uint64_t timed_out;
+    };
+
+private:
+    std::set<const txn_stats*> managers;
+    totals_t retired;
+
+    inline explicit txn_registry() : enabled{false}, retired{0, 0, 0, 0} {}
+
+public:
+    txn_registry(const txn_registry&) = delete;
+    txn_registry& operator=(const txn_registry&) = delete;
+
+    inline void set_enable(bool enabled) { this->enabled = enabled; }
+
+    inline bool add(const txn_stats* stats){
+        if (!enabled) return false;
+        std::lock_guard lock{m};
+        managers.insert(stats);
+        return true;
+    }
+
+    inline void remove(const txn_stats* stats){
+        std::lock_guard lock{m};
+        managers.erase(stats);
+        retired.managers++;
+        retired.registered += stats->registered.load(std::memory_order_relaxed);
+        retired.responded += stats->responded.load(std::memory_order_relaxed);
+        retired.timed_out += stats->timed_out.load(std::memory_order_relaxed);
+    }
+
+    inline totals_t totals(){
+        std::lock_guard lock{m};
+        totals_t t = retired;
+        t.managers += managers.size();
+        for (auto stats : managers){
+            t.registered += stats->registered.load(std::memory_order_relaxed);
+            t.responded += stats->responded.load(std::memory_order_relaxed);
+            t.timed_out += stats->timed_out.load(std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    inline static txn_registry& get_instance(){
+        static txn_registry instance;
+        return instance;
+    }
+};
+
+// written by Derived::request, read by async_req for RTT samples
+template <typename clock_t>
+struct transmissions{
+    // schedule, picked by async_req before request() starts
+    retransmit_params params;
+    std::chrono::microseconds rto;
+
+    std::atomic<uint32_t> count{0};
+    std::atomic<typename clock_t::rep> last{0};
+    // set once the transaction is over, request() returns at its next wakeup
+    std::atomic<bool> stopped{false};
+    // set by request() when the schedule ran out, as opposed to the
+    // transaction being abandoned through onTimeout
+    std::atomic<bool> exhausted{false};
+
+    inline void sent(){
+        last.store(clock_t::now().time_since_epoch().count());
+        count.fetch_add(1);
+    }
+    inline typename clock_t::time_point last_sent() const {
+        return typename clock_t::time_point{typename clock_t::duration{last.load()}};
+    }
+};
+
 template <typename Derived, typename ipinfo_t>
 class client{
 public:    
+    // One per client unless shared explicitly, e.g. when answers to one
+    // client's requests arrive on another client's socket (RESPONSE-PORT).
     class txn_manager{
     public:
         using expected_res_t = std::expected<
@@ -21,16 +125,17 @@ public:
                                 >;
 
         struct reg_awaiter{
+            txn_manager& manager;
             stun::txn_id_t txn_id;
             expected_res_t response;
             bool await_ready() const noexcept { return false; }
-            void await_suspend(std::coroutine_handle<> handle) noexcept {
-                get_instance().register_txn(handle, this);
+            bool await_suspend(std::coroutine_handle<> handle) noexcept {
+                return manager.suspend_txn(handle, this);
             }
             expected_res_t& await_resume(){
                 return response;
             }
-            reg_awaiter(stun::txn_id_t id): txn_id{id} {}
+            reg_awaiter(txn_manager& manager, stun::txn_id_t id): manager{manager}, txn_id{id} {}
             
         };
 
@@ -39,86 +144,138 @@ public:
         struct txn_t{
             std::coroutine_handle<> handle;
             reg_awaiter* awaiter;
+        };
 
-            txn_t(std::coroutine_handle<> handle,  reg_awaiter* awaiter): handle{handle}, awaiter{awaiter} {}
+        // txn ids are 96 random bits, any 64 of them are a good hash
+        struct txn_hash{
+            size_t operator()(const stun::txn_id_t& id) const {
+                uint64_t h;
+                std::memcpy(&h, id.data, sizeof(h));
+                return h;
+            }
         };
 
-        std::map<stun::txn_id_t, txn_t> txns;
-        std::mutex m;
+        structs::sharded_table<stun::txn_id_t, txn_t, txn_hash, 8, 256> txns;
+        txn_stats stats;
+        bool listed;
+
+        // the awaiter is filled in under the shard lock, the completion is
+        // logged and the coroutine resumed after the entry is gone and the
+        // lock released
+        template <typename func_t>
+        void complete(const stun::txn_id_t& txn_id, std::string_view event, func_t&& fill){
+            auto txn = txns.take(txn_id, [&](txn_t& t){ fill(*t.awaiter); });
+            if (!txn.has_value()) return;
+            log::sync().info("transaction {} on {}\n", math::tohex(txn_id), event);
+            if (txn->handle) Derived::resume_txn(txn->handle);
+        }
     public:
-        void register_txn(std::coroutine_handle<> handle, reg_awaiter* awaiter){
-            std::lock_guard lock{m};
-
-            txns.emplace(std::piecewise_construct, 
-                std::forward_as_tuple(awaiter->txn_id), 
-                std::forward_as_tuple(handle, awaiter));
+        // shared by every client on this manager
+        rto_estimator<ipinfo_t> rto;
+
+        txn_manager() : listed{txn_registry::get_instance().add(&stats)} {}
+        txn_manager(const txn_manager&) = delete;
+        txn_manager& operator=(const txn_manager&) = delete;
+        ~txn_manager(){
+            if (!listed) return;
+            auto& registry = txn_registry::get_instance();
+            registry.remove(&stats);
+            auto t = registry.totals();
+            log::sync().info("txn manager closed: {} registered, {} responded, {} timed out; process: {} managers, {} registered\n",
+                stats.registered.load(), stats.responded.load(), stats.timed_out.load(), t.managers, t.registered);
         }
 
-        void onResponse(ipinfo_t&& ip, stun::message&& msg){
-
-
-            std::lock_guard lock{m};
-            auto it = txns.find(msg.get_txn_id());
-            if (it != txns.end()){
-                log::sync().info("transaction {} on response\n", math::tohex(it->first));
-                it->second.awaiter->response = std::move(std::make_tuple(std::move(ip), std::move(msg)));
-                it->second.handle.resume();
-                txns.erase(it);
-            }
-
+        // registered before the request is sent, so an answer arriving
+        // ahead of the suspension is kept in the awaiter
+        bool register_txn(reg_awaiter* awaiter){
+            if (!txns.insert(awaiter->txn_id, txn_t{nullptr, awaiter})) return false;
+            stats.registered.fetch_add(1, std::memory_order_relaxed);
+            return true;
         }
 
-        void onTimeout(stun::txn_id_t txn_id){
-            std::lock_guard lock{m};
-
-            auto it = txns.find(txn_id);
-            if (it != txns.end()){
-                log::sync().info("transaction {} on timeout\n", math::tohex(it->first));
-                it->second.awaiter->response = std::unexpected("Timeout");
-                it->second.handle.resume();
-                txns.erase(it);
-            }
+        bool suspend_txn(std::coroutine_handle<> handle, reg_awaiter* awaiter){
+            return txns.update(awaiter->txn_id, [&](txn_t& t){ t.handle = handle; });
         }
 
+        void onResponse(ipinfo_t&& ip, stun::message&& msg){
+            auto txn_id = msg.get_txn_id();
+            complete(txn_id, "response", [&](reg_awaiter& awaiter){
+                stats.responded.fetch_add(1, std::memory_order_relaxed);
+                awaiter.response = std::make_tuple(std::move(ip), std::move(msg));
+            });
+        }
 
-
-        static txn_manager& get_instance(){
-            static txn_manager instance;
-            return instance;
+        void onTimeout(stun::txn_id_t txn_id){
+            complete(txn_id, "timeout", [&](reg_awaiter& awaiter){
+                stats.timed_out.fetch_add(1, std::memory_order_relaxed);
+                awaiter.response = std::unexpected("Timeout");
+            });
         }
 
     };
 protected:
+    std::shared_ptr<txn_manager> txns;
+
+    // where a finished request continues; Derived may hide this
+    static void resume_txn(std::coroutine_handle<> handle){
+        handle.resume();
+    }
+
     inline void onResponse(ipinfo_t&& ip, stun::message&& msg){
-        txn_manager::get_instance().onResponse(std::move(ip), std::move(msg));
+        txns->onResponse(std::move(ip), std::move(msg));
     }
 
     inline void onTimeout(stun::txn_id_t txn_id){
-        txn_manager::get_instance().onTimeout(txn_id);
+        txns->onTimeout(txn_id);
     }
 private:
-    coro::timer::delay_task request(const ipinfo_t& ip, const stun::message& msg){
+    // calls tx.sent() on every transmission
+    template <typename clock_t>
+    coro::timer::delay_task request(const ipinfo_t& ip, const stun::message& msg, transmissions<clock_t>& tx){
         co_return;
     }
 
 public:
 
-    explicit client() = default;
-    
-    coro::lazy_task<typename txn_manager::expected_res_t> 
-        async_req(const ipinfo_t& ip, const stun::message& msg){
-            typename txn_manager::reg_awaiter awaiter{msg.get_txn_id()};
+    using req_task = coro::lazy_task<typename txn_manager::expected_res_t>;
 
-            auto delaytask = static_cast<Derived*>(this)->request(ip, msg);
-            auto& res = co_await awaiter;
-            
-            if (res.has_value()){
-                delaytask.cancel();
-            }
+    explicit client(std::shared_ptr<txn_manager> shared = nullptr)
+        : txns{shared ? std::move(shared) : std::make_shared<txn_manager>()} {}
 
-            co_return std::move(res);
+    inline const std::shared_ptr<txn_manager>& get_txn_manager() const { return txns; }
+
+    inline void set_retransmit_params(const retransmit_params& params){ txns->rto.set_params(params); }
+    
+    // with a fixed schedule the RTO is params.initial_rto; the estimator is
+    // not consulted but still learns from the answer
+    req_task async_req(const ipinfo_t& ip, const stun::message& msg, std::optional<retransmit_params> fixed = std::nullopt){
+        using clock_t = typename Derived::clock_t;
+        typename txn_manager::reg_awaiter awaiter{*txns, msg.get_txn_id()};
+        if (!txns->register_txn(&awaiter)){
+            co_return std::unexpected(std::format("failed to register transaction {}", math::tohex(msg.get_txn_id())));
         }
 
+        transmissions<clock_t> tx;
+        tx.params = fixed.value_or(txns->rto.get_params());
+        tx.rto = fixed.has_value() ? fixed->initial_rto : txns->rto.rto(ip);
+        auto delaytask = static_cast<Derived*>(this)->request(ip, msg, tx);
+        auto& res = co_await awaiter;
+        
+        // request() holds tx and the client, it has to be gone before we return
+        tx.stopped.store(true);
+        if (!delaytask.cancel()) co_await delaytask;
+
+        if (res.has_value()){
+            // Karn: a retransmitted request's answer could belong to any copy
+            if (tx.count.load() == 1) txns->rto.sample(ip, clock_t::now() - tx.last_sent());
+        } else if (!fixed.has_value() && tx.exhausted.load()){
+            // a fixed schedule or an abandoned probe says nothing about ip
+            txns->rto.backoff(ip);
+        }
+
+        co_return std::move(res);
+    }
+
 };
 
 
@@ -126,19 +283,44 @@ class client_udpv4 : public client<client_udpv4, net::ipv4>{
 private:
     friend class client<client_udpv4, net::ipv4>;
 
+public:
+    using clock_t = std::chrono::steady_clock;
+
+private:
     net::udpv4 udp;
     net::ipv4 self_addr;
+    token_bucket<clock_t> pacer;
 
+    // either a thread of our own or a slot on a shared reactor
     std::jthread listener_thread;
+    net::reactor* reactor;
+    std::atomic<bool> answering;
 
+    // false once nothing is left to read
+    bool receive();
+    void answer(const net::ipv4& ip, const stun::message& req);
     void listener(std::stop_token st);
     void start_listener();
 
 
-    coro::timer::delay_task request(const net::ipv4& ip, const stun::message& msg);
+    coro::timer::delay_task request(const net::ipv4& ip, const stun::message& msg, transmissions<clock_t>& tx);
+
+    // not on the listener, which must keep receiving and may be joined by
+    // whatever the awaiting coroutine does next
+    static void resume_txn(std::coroutine_handle<> handle){
+        coro::thread::dispatch(handle);
+    }
+
+    // a slot from both this socket's and the process-wide bucket
+    inline clock_t::duration pace(){
+        return std::max(pacer.reserve(), token_bucket<clock_t>::global().reserve());
+    }
 
 public:
-    explicit inline client_udpv4(uint32_t net_ip, uint16_t net_port) : self_addr{net_ip, net_port} {
+
+    // exits the process if the port cannot be bound, see open() otherwise
+    explicit inline client_udpv4(uint32_t net_ip, uint16_t net_port, std::shared_ptr<txn_manager> shared = nullptr)
+        : client{std::move(shared)}, self_addr{net_ip, net_port}, pacer{default_socket_pacing()}, reactor{nullptr}, answering{false} {
         if (!udp.bind(net::ipv4{net_ip, net_port})){
             std::exit(1);
         }
@@ -146,8 +328,51 @@ public:
         start_listener();
     }
 
-    ~client_udpv4(){ listener_thread.request_stop(); }
+    // takes over a socket already bound to self_addr, received on by
+    // reactor if given and by a thread of its own otherwise
+    explicit inline client_udpv4(net::udpv4&& socket, net::ipv4 self_addr, std::shared_ptr<txn_manager> shared = nullptr, net::reactor* reactor = nullptr)
+        : client{std::move(shared)}, udp{std::move(socket)}, self_addr{self_addr}, pacer{default_socket_pacing()}, reactor{reactor}, answering{false} {
+        if (reactor != nullptr){
+            udp.set_nonblocking();
+            reactor->add(udp.native_handle(), [this]{ while (this->receive()); });
+        } else {
+            udp.set_timeout(3);
+            start_listener();
+        }
+    }
+
+    static std::expected<std::unique_ptr<client_udpv4>, std::string> open(uint32_t net_ip, uint16_t net_port, std::shared_ptr<txn_manager> shared = nullptr, net::reactor* reactor = nullptr){
+        net::ipv4 addr{net_ip, net_port};
+        auto socket = net::udpv4::open(addr);
+        if (!socket.has_value()){
+            return std::unexpected(std::format("failed to bind {}", addr.toString()));
+        }
+        return std::make_unique<client_udpv4>(std::move(socket.value()), addr, std::move(shared), reactor);
+    }
+
+    ~client_udpv4(){
+        if (reactor != nullptr){
+            reactor->remove(udp.native_handle());
+        } else {
+            listener_thread.request_stop();
+        }
+    }
     inline const net::ipv4& get_self_addr() const { return self_addr; }
+    inline const net::udpv4& get_socket() const { return udp; }
+    inline void set_pacing(pacing p) { pacer.configure(p); }
+    // nothing more is read from the socket, e.g. before passing it on;
+    // requests still in flight time out
+    inline void stop_receiving(){
+        if (reactor != nullptr){
+            reactor->remove(udp.native_handle());
+        } else if (listener_thread.joinable()){
+            listener_thread.request_stop();
+            listener_thread.join();
+        }
+    }
+    // answer Binding requests like a server would, for peers checking the
+    // path to this socket; off by default, requests are dropped then
+    inline void set_answer_binding(bool on) { answering.store(on); }
 
 };
 
@@ -0,0 +1,208 @@
+#include <fstream>
+#include <map>
+
+#include "discovery.h"
+#include "log.h"
+#include "nat_sim.h"
+
+std::expected<std::vector<net::ipv4>, std::string> load_server_list(std::string_view path){
+    std::ifstream file{std::string(path)};
+    if (!file.is_open()){
+        return std::unexpected(std::format("failed to open server list: {}", path));
+    }
+
+    std::vector<net::ipv4> servers;
+    std::string line;
+    while (std::getline(file, line)){
+        std::string_view l{line};
+        while (!l.empty() && (l.back() == '\r' || l.back() == ' ')) l.remove_suffix(1);
+        while (!l.empty() && l.front() == ' ') l.remove_prefix(1);
+        if (l.empty() || l.front() == '#') continue;
+
+        auto addr = net::parse_addr(l);
+        if (!addr.has_value()){
+            log::sync().warn("skipping server {}: {}\n", l, addr.error());
+            continue;
+        }
+        servers.push_back(addr.value());
+    }
+
+    if (servers.empty()){
+        return std::unexpected(std::format("no usable server in {}", path));
+    }
+    return servers;
+}
+
+
+namespace {
+    // The RTT async_req sampled, from the last transmission to the answer,
+    // so a wait for a pacing slot before the send does not count. Read as
+    // the answer arrives rather than when collect() gets to it.
+    template <typename client_t, typename task_t>
+    coro::lazy_task<std::optional<std::chrono::nanoseconds>> settle(client_t& c, const net::ipv4& server, task_t& task, std::atomic<uint32_t>& settled){
+        co_await task;
+        auto rtt = c.get_txn_manager()->rto.srtt(server);
+        settled.fetch_add(1, std::memory_order_release);
+        settled.notify_all();
+        if (!rtt.has_value()) co_return std::nullopt;
+        co_return std::chrono::duration_cast<std::chrono::nanoseconds>(rtt.value());
+    }
+}
+
+template <typename client_t>
+server_race<client_t>::probe::probe(client_t& c, const net::ipv4& server, std::atomic<uint32_t>& settled) :
+    server{server},
+    msg(stun::msg_method::BINDING | stun::msg_type::REQUEST),
+    task{c.async_req(this->server, msg)},
+    rtt{settle(c, this->server, task, settled)},
+    collected{false} {}
+
+template <typename client_t>
+server_race<client_t>::server_race(client_t& c, std::span<const net::ipv4> servers) : c{c}, settled{0} {
+    for (auto& server : servers){
+        probes.emplace_back(c, server, settled);
+    }
+}
+
+template <typename client_t>
+std::expected<discovery_result, std::string> server_race<client_t>::collect(size_t wanted){
+    discovery_result result{net::ipv4{}, 0, {}, {}};
+    size_t pending = 0;
+
+    do {
+        // read before looking, so a probe finishing in between still wakes us
+        auto seen = settled.load(std::memory_order_acquire);
+        pending = 0;
+        for (auto& p : probes){
+            if (p.collected) continue;
+            if (!p.rtt.done()){
+                pending++;
+                continue;
+            }
+
+            p.collected = true;
+            auto& res = p.task.get();
+            if (!res.has_value()){
+                result.failed.push_back(p.server);
+                continue;
+            }
+
+            auto& msg = std::get<1>(res.value());
+            if (msg.get_type() != (stun::msg_method::BINDING | stun::msg_type::SUCCESS_RESPONSE)){
+                result.failed.push_back(p.server);
+                continue;
+            }
+
+            auto [x_addr, otheraddr] = msg.template find<stun::ipv4_xor_mappedAddress, stun::ipv4_otherAddress>();
+            if (x_addr == nullptr){
+                result.failed.push_back(p.server);
+                continue;
+            }
+
+            result.answers.push_back(server_answer{
+                p.server,
+                net::ipv4{x_addr->get_net_address(), x_addr->get_net_port()},
+                otheraddr != nullptr,
+                p.rtt.get()
+            });
+            if (result.answers.size() >= wanted) break;
+        }
+        if (pending > 0 && result.answers.size() < wanted) settled.wait(seen, std::memory_order_acquire);
+    } while (pending > 0 && result.answers.size() < wanted);
+
+    for (auto& p : probes){
+        if (!p.collected && !p.task.done()) c.get_txn_manager()->onTimeout(p.msg.get_txn_id());
+    }
+
+    if (result.answers.empty()){
+        return std::unexpected("no server answered");
+    }
+
+    std::map<net::ipv4, size_t> votes;
+    for (auto& answer : result.answers){
+        auto count = ++votes[answer.mapped];
+        if (count > result.agreeing){
+            result.mapped = answer.mapped;
+            result.agreeing = count;
+        }
+    }
+    return result;
+}
+
+template class server_race<clientImpl>;
+
+
+nat_discovery_config<clientImpl>::open_t open_on(uint32_t bind_address, net::reactor* reactor){
+    return [bind_address, reactor](std::shared_ptr<clientImpl::txn_manager> shared){
+        // random ports collide now and then
+        std::expected<std::unique_ptr<clientImpl>, std::string> opened = std::unexpected("no port tried");
+        for (int i = 0; i < 8 && !opened.has_value(); i++){
+            opened = clientImpl::open(bind_address, net::random_pri_iana_net_port(), shared, reactor);
+        }
+        return opened;
+    };
+}
+
+namespace {
+    // the supplied client, or a new one kept alive in owned
+    template <typename client_t>
+    std::expected<client_t*, std::string> use_or_open(client_t* supplied, std::unique_ptr<client_t>& owned,
+                                                      const typename nat_discovery_config<client_t>::open_t& open,
+                                                      std::shared_ptr<typename client_t::txn_manager> shared = nullptr){
+        if (supplied != nullptr) return supplied;
+        if (!open) return std::unexpected("no socket supplied and no way to open one");
+
+        auto c = open(std::move(shared));
+        if (!c.has_value()) return std::unexpected(std::move(c.error()));
+        owned = std::move(c.value());
+        return owned.get();
+    }
+}
+
+template <typename client_t>
+coro::lazy_task<std::expected<nat_discovery_result, std::string>> discover_nat(nat_discovery_config<client_t> config){
+    std::unique_ptr<client_t> owned_primary, owned_aux;
+    auto primary = use_or_open(config.primary, owned_primary, config.open);
+    if (!primary.has_value()) co_return std::unexpected(std::move(primary.error()));
+
+    nat_discovery_result result{primary.value()->get_self_addr(), net::ipv4{}, std::nullopt, std::nullopt};
+
+    auto mapped = co_await async_build_binding(*primary.value(), config.server);
+    if (!mapped.has_value()) co_return std::unexpected(std::move(mapped.error()));
+    result.mapped = mapped.value();
+
+    if (config.behavior){
+        auto aux = use_or_open(config.aux, owned_aux, config.open);
+        if (!aux.has_value()) co_return std::unexpected(std::move(aux.error()));
+
+        auto type = co_await async_nat_test(*primary.value(), *aux.value(), config.server);
+        if (!type.has_value()) co_return std::unexpected(std::move(type.error()));
+        result.type = type.value();
+    }
+
+    if (config.lifetime){
+        std::unique_ptr<client_t> Y;
+        auto y = use_or_open<client_t>(nullptr, Y, config.open);
+        if (!y.has_value()) co_return std::unexpected(std::move(y.error()));
+
+        size_t count = std::max<size_t>(config.lifetime_bindings, 1);
+        std::vector<std::unique_ptr<client_t>> owned_X(count);
+        std::vector<client_t*> X;
+        for (auto& x : owned_X){
+            auto c = use_or_open<client_t>(nullptr, x, config.open, Y->get_txn_manager());
+            if (!c.has_value()) co_return std::unexpected(std::move(c.error()));
+            X.push_back(c.value());
+        }
+
+        auto lifetime = config.lifetime_bindings > 0
+            ? co_await parallel_lifetime_test<client_t>(X, *Y, config.server, config.lifetime_cfg)
+            : co_await lifetime_test(*X.front(), *Y, config.server);
+        if (!lifetime.has_value()) co_return std::unexpected(std::move(lifetime.error()));
+        result.lifetime = lifetime.value();
+    }
+
+    co_return result;
+}
+
+template coro::lazy_task<std::expected<nat_discovery_result, std::string>> discover_nat(nat_discovery_config<clientImpl>);
+template coro::lazy_task<std::expected<nat_discovery_result, std::string>> discover_nat(nat_discovery_config<sim::client_sim>);
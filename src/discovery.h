@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "client.h"
+#include "nat_test.h"
+#include "stun.h"
+
+struct server_answer
+{
+    net::ipv4 server;
+    net::ipv4 mapped;
+    // OTHER-ADDRESS present, i.e. usable for nat_test
+    bool behavior_discovery;
+    // from the last transmission, empty if only a retransmission was answered
+    std::optional<std::chrono::nanoseconds> rtt;
+};
+
+struct discovery_result
+{
+    // the mapped address reported by most servers
+    net::ipv4 mapped;
+    size_t agreeing;
+    // in order of arrival
+    std::vector<server_answer> answers;
+    // timed out or answered with an error before the race was decided
+    std::vector<net::ipv4> failed;
+};
+
+// one "ip:port" per line, blank lines and '#' comments are skipped
+std::expected<std::vector<net::ipv4>, std::string> load_server_list(std::string_view path);
+
+// Sends a Binding request to every server from one socket as soon as it is
+// constructed. Probes still out once collect() has its answers are
+// abandoned, so destroying the race right after does not wait for them.
+template <typename client_t>
+class server_race{
+private:
+    struct probe{
+        net::ipv4 server;
+        stun::message msg;
+        typename client_t::req_task task;
+        // awaits task, so it is destroyed first
+        coro::lazy_task<std::optional<std::chrono::nanoseconds>> rtt;
+        bool collected;
+
+        probe(client_t& c, const net::ipv4& server, std::atomic<uint32_t>& settled);
+    };
+
+    client_t& c;
+    // bumped as each probe finishes, collect() sleeps on it
+    std::atomic<uint32_t> settled;
+    std::list<probe> probes;
+
+public:
+    explicit server_race(client_t& c, std::span<const net::ipv4> servers);
+    server_race(const server_race&) = delete;
+    server_race& operator=(const server_race&) = delete;
+
+    // returns once `wanted` servers answered or every probe finished
+    std::expected<discovery_result, std::string> collect(size_t wanted);
+};
+
+
+template <typename client_t>
+struct nat_discovery_config
+{
+    using open_t = std::function<std::expected<std::unique_ptr<client_t>, std::string>(std::shared_ptr<typename client_t::txn_manager>)>;
+
+    net::ipv4 server = net::ipv4{};
+    // opens every socket not supplied below, sharing the txn manager when
+    // one is given
+    open_t open;
+    // caller-owned sockets, they must outlive the task
+    client_t* primary = nullptr;
+    client_t* aux = nullptr;
+    // mapping and filtering behavior, needs an RFC 5780 server
+    bool behavior = true;
+    bool lifetime = false;
+    // > 0 runs parallel_lifetime_test with this many bindings
+    size_t lifetime_bindings = 0;
+    lifetime_params lifetime_cfg{};
+};
+
+// sockets on a random port of bind_address, network byte order; served by
+// reactor when it is not null, otherwise each gets a listener thread
+nat_discovery_config<clientImpl>::open_t open_on(uint32_t bind_address, net::reactor* reactor = nullptr);
+
+struct nat_discovery_result
+{
+    net::ipv4 local;
+    net::ipv4 mapped;
+    std::optional<nat_type> type;
+    std::optional<uint64_t> lifetime;
+};
+
+// Embeddable form of what main does with -b/-t/-s. It never blocks, prints
+// or exits; any number can run at once on the shared timer and thread pool.
+// The lifetime test always opens its own sockets, since its two sides have
+// to share a txn manager.
+template <typename client_t>
+coro::lazy_task<std::expected<nat_discovery_result, std::string>> discover_nat(nat_discovery_config<client_t> config);
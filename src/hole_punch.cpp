@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <list>
+
+#include "hole_punch.h"
+#include "nat_test.h"
+#include "log.h"
+
+namespace {
+    int64_t wall_ms(){
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // The peer's offer may be delivered before, during or after the
+    // suspension; whichever of deliver and await_suspend comes second
+    // resumes the coroutine, on the pool.
+    struct offer_awaiter{
+        signalling& signal;
+        const punch_offer& local;
+        std::expected<punch_offer, std::string> offer;
+        std::atomic<bool> arrived;
+        std::coroutine_handle<> handle;
+
+        offer_awaiter(signalling& signal, const punch_offer& local)
+            : signal{signal}, local{local}, offer{std::unexpected("no offer")}, arrived{false} {}
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h){
+            handle = h;
+            signal(local, [this](std::expected<punch_offer, std::string> o){
+                offer = std::move(o);
+                if (arrived.exchange(true)) coro::thread::dispatch(handle);
+            });
+            return !arrived.exchange(true);
+        }
+        std::expected<punch_offer, std::string> await_resume(){
+            return std::move(offer);
+        }
+    };
+
+    // Decided by the first probe answered, or by the last one giving up.
+    // Like offer_awaiter, whichever of decide and await_suspend comes second
+    // resumes the coroutine, on the pool.
+    struct first_answer{
+        std::atomic<size_t> pending;
+        std::atomic<bool> decided;
+        std::atomic<bool> arrived;
+        std::coroutine_handle<> handle;
+        std::optional<net::ipv4> remote;
+
+        explicit first_answer(size_t probes) : pending{probes}, decided{false}, arrived{false} {}
+
+        void decide(std::optional<net::ipv4> from){
+            if (decided.exchange(true)) return;
+            remote = from;
+            if (arrived.exchange(true)) coro::thread::dispatch(handle);
+        }
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h){
+            handle = h;
+            return !arrived.exchange(true);
+        }
+        std::optional<net::ipv4> await_resume(){
+            return remote;
+        }
+    };
+
+    struct punch_probe{
+        // async_req keeps references to both
+        net::ipv4 target;
+        stun::message msg;
+        client_udpv4::req_task task;
+        // awaits task, so it is destroyed first
+        coro::lazy_task<bool> watcher;
+
+        punch_probe(client_udpv4& c, net::ipv4 target, const retransmit_params& schedule, first_answer& race) :
+            target{target},
+            msg{stun::msg_method::BINDING | stun::msg_type::REQUEST},
+            task{c.async_req(this->target, msg, schedule)},
+            watcher{watch(*this, race)} {}
+
+        bool answered(){
+            auto& res = task.get();
+            return res.has_value() && std::get<1>(res.value()).get_type() == (stun::msg_method::BINDING | stun::msg_type::SUCCESS_RESPONSE);
+        }
+
+        static coro::lazy_task<bool> watch(punch_probe& p, first_answer& race){
+            co_await p.task;
+            bool answered = p.answered();
+            if (answered){
+                race.decide(std::get<0>(p.task.get().value()));
+            } else if (race.pending.fetch_sub(1) == 1){
+                race.decide(std::nullopt);
+            }
+            co_return answered;
+        }
+    };
+}
+
+signalling loopback_signalling::channel(std::string key){
+    return [this, key = std::move(key)](const punch_offer& local, offer_callback deliver){
+        std::unique_lock lock{m};
+        auto it = pending.find(key);
+        if (it == pending.end()){
+            pending.emplace(key, waiting{local, std::move(deliver)});
+            return;
+        }
+        auto other = std::move(it->second);
+        pending.erase(it);
+        lock.unlock();
+
+        other.deliver(local);
+        deliver(other.offer);
+    };
+}
+
+hole_puncher::hole_puncher(net::ipv4 server, uint32_t bind_address, punch_params params)
+    : server{server}, bind_address{bind_address}, params{params} {}
+
+std::vector<net::ipv4> hole_puncher::candidates(const punch_offer& peer) const{
+    std::vector<net::ipv4> out;
+    auto add = [&](net::ipv4 addr){
+        if (addr.net_port != 0 && std::ranges::find(out, addr) == out.end()) out.push_back(addr);
+    };
+    add(peer.mapped);
+    add(peer.local);
+
+    if (peer.stride > 0){
+        size_t count = ((peer.last - peer.first + 65536) % 65536) / peer.stride + 1;
+        count = std::min(count, params.max_candidates);
+        for (size_t i = 0; i < count; i++){
+            auto port = static_cast<uint16_t>(peer.first + i * peer.stride);
+            add(net::ipv4{peer.mapped.net_address, math::hton<uint16_t>(port)});
+        }
+    }
+    return out;
+}
+
+coro::lazy_task<std::expected<punch_result, std::string>> hole_puncher::punch(signalling signal, std::optional<port_prediction> prediction){
+    // random ports collide now and then
+    constexpr int attempts = 8;
+    std::expected<std::unique_ptr<client_udpv4>, std::string> opened = std::unexpected("no port tried");
+    for (int i = 0; i < attempts && !opened.has_value(); i++){
+        opened = client_udpv4::open(bind_address, net::random_pri_iana_net_port(), nullptr, &reactor);
+    }
+    if (!opened.has_value()) co_return std::unexpected(std::move(opened.error()));
+    auto& c = *opened.value();
+    c.set_answer_binding(true);
+
+    auto mapped = co_await async_build_binding(c, server);
+    if (!mapped.has_value()) co_return std::unexpected(std::format("no mapped address: {}", mapped.error()));
+
+    punch_offer local{c.get_self_addr(), mapped.value(), 0, 0, 0, wall_ms() + params.lead.count()};
+    if (prediction.has_value() && prediction->pattern == allocation_pattern::sequential){
+        local.first = prediction->first;
+        local.last = prediction->last;
+        local.stride = prediction->stride;
+    }
+
+    auto peer = co_await offer_awaiter{signal, local};
+    if (!peer.has_value()) co_return std::unexpected(std::format("signalling failed: {}", peer.error()));
+
+    // a peer whose clock runs far ahead is not waited for
+    auto wait = std::clamp<int64_t>(std::max(local.start, peer->start) - wall_ms(), 0, 2 * params.lead.count());
+    if (wait > 0) co_await coro::timer::delay_awaiter{std::chrono::milliseconds{wait}};
+
+    auto targets = candidates(peer.value());
+    first_answer race{targets.size()};
+    std::list<punch_probe> probes;
+    for (auto& target : targets){
+        probes.emplace_back(c, target, params.probe, race);
+    }
+    if (targets.empty()) race.decide(std::nullopt);
+    auto remote = co_await race;
+
+    // the others are abandoned, finished ones are no longer in the table
+    for (auto& p : probes){
+        c.get_txn_manager()->onTimeout(p.msg.get_txn_id());
+    }
+    for (auto& p : probes){
+        co_await p.watcher;
+    }
+    if (!remote.has_value()){
+        co_return std::unexpected(std::format("none of {} candidates of {} answered", targets.size(), peer->mapped.toString()));
+    }
+
+    // sampled from the send to the answer, so pacing waits do not count
+    size_t answered = 0;
+    for (uint32_t i = 0; i < params.rtt_probes; i++){
+        stun::message msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+        auto res = co_await c.async_req(remote.value(), msg);
+        answered += res.has_value();
+    }
+    auto rtt = c.get_txn_manager()->rto.min_rtt(remote.value());
+    if (answered == 0){
+        co_return std::unexpected(std::format("{} answered once, then stopped", remote->toString()));
+    }
+    if (!rtt.has_value()){
+        co_return std::unexpected(std::format("no RTT sample from {}, every probe was retransmitted", remote->toString()));
+    }
+
+    log::async().info("punched {} -> {} with {} candidates, rtt {}ns\n",
+        c.get_self_addr().toString(), remote->toString(), targets.size(), rtt->count());
+    co_return punch_result{std::move(opened.value()), mapped.value(), remote.value(), rtt.value(), targets.size()};
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "client.h"
+#include "port_prediction.h"
+#include "net/reactor.h"
+
+// what one side tells the other before punching
+struct punch_offer
+{
+    // the socket's own address, reachable when both are behind the same NAT
+    net::ipv4 local;
+    // as seen by the STUN server
+    net::ipv4 mapped;
+    // where the NAT should map this socket toward a new destination, host
+    // byte order; all 0 unless predicted sequential
+    uint16_t first;
+    uint16_t last;
+    int32_t stride;
+    // system_clock milliseconds, both sides start at the later of the two
+    int64_t start;
+};
+
+struct punch_params
+{
+    // from building the offer to the first probe, covers the signalling
+    // round trip so the peer's probes go out about when ours do
+    std::chrono::milliseconds lead{300};
+    // every candidate is probed on this schedule, a burst per transmission
+    retransmit_params probe{7, 16, std::chrono::milliseconds{20}, std::chrono::milliseconds{20}, std::chrono::milliseconds{20}};
+    // predicted ports beyond the local and mapped address
+    size_t max_candidates = 64;
+    // Binding requests over the found path, the fastest is the RTT
+    uint32_t rtt_probes = 3;
+};
+
+struct punch_result
+{
+    // the punched socket; it keeps answering the peer's checks until the
+    // caller turns that off
+    std::unique_ptr<client_udpv4> socket;
+    net::ipv4 mapped;
+    // the address the peer answered from
+    net::ipv4 remote;
+    // the fastest answer from remote, punching probes included
+    std::chrono::nanoseconds rtt;
+    size_t candidates;
+};
+
+// Hands the local offer to the peer and the peer's offer back through
+// deliver, exactly once and from any thread.
+using offer_callback = std::function<void(std::expected<punch_offer, std::string>)>;
+using signalling = std::function<void(const punch_offer& local, offer_callback deliver)>;
+
+// Both sides in one process: the first offer posted under a key waits for
+// the second, then each is delivered to the other.
+class loopback_signalling{
+private:
+    struct waiting{
+        punch_offer offer;
+        offer_callback deliver;
+    };
+
+    std::mutex m;
+    std::map<std::string, waiting> pending;
+
+public:
+    explicit loopback_signalling() = default;
+    loopback_signalling(const loopback_signalling&) = delete;
+    loopback_signalling& operator=(const loopback_signalling&) = delete;
+
+    // must outlive every exchange on it
+    signalling channel(std::string key);
+};
+
+// UDP hole punching between two peers that only know a STUN server and a
+// signalling channel. Each punch() opens a socket, learns its mapped
+// address, swaps offers with the peer, then from an agreed start time
+// sends Binding requests to every candidate address of the peer while
+// answering the peer's. The first answer is the path. All sockets share
+// one reactor thread, so many punches can run at once.
+class hole_puncher{
+private:
+    net::ipv4 server;
+    uint32_t bind_address;
+    punch_params params;
+
+    // declared first, destroyed after every socket on it
+    net::reactor reactor;
+
+    std::vector<net::ipv4> candidates(const punch_offer& peer) const;
+
+public:
+    explicit hole_puncher(net::ipv4 server, uint32_t bind_address, punch_params params = {});
+    hole_puncher(const hole_puncher&) = delete;
+    hole_puncher& operator=(const hole_puncher&) = delete;
+
+    // the prediction, if any, should come from sampling right before; the
+    // puncher must outlive the task
+    coro::lazy_task<std::expected<punch_result, std::string>> punch(signalling signal, std::optional<port_prediction> prediction = std::nullopt);
+};
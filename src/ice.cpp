@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <limits>
+#include <list>
+
+#include "ice.h"
+#include "nat_test.h"
+#include "log.h"
+
+namespace {
+    // RFC 8445 5.1.2.2
+    constexpr uint32_t type_preference(candidate_type type){
+        switch (type){
+            case candidate_type::host: return 126;
+            case candidate_type::peer_reflexive: return 110;
+            default: return 100;
+        }
+    }
+
+    bool same_foundation(const candidate_pair& a, const candidate_pair& b){
+        return a.local.foundation == b.local.foundation && a.remote.foundation == b.remote.foundation;
+    }
+
+    struct ice_check{
+        size_t pair;
+        // async_req keeps references to both
+        net::ipv4 target;
+        stun::message msg;
+        client_udpv4::req_task task;
+
+        static stun::message make(uint32_t priority, bool controlling, uint64_t tie_breaker){
+            stun::message msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+            msg.emplace<stun::icePriority>(math::hton(priority));
+            if (controlling){
+                msg.emplace<stun::iceControlling>(tie_breaker);
+            } else {
+                msg.emplace<stun::iceControlled>(tie_breaker);
+            }
+            return msg;
+        }
+
+        ice_check(client_udpv4& c, size_t pair, net::ipv4 target, const ice_params& params, uint64_t tie_breaker) :
+            pair{pair},
+            target{target},
+            msg{make(candidate_priority(candidate_type::peer_reflexive), params.controlling, tie_breaker)},
+            task{c.async_req(this->target, msg, params.check)} {}
+    };
+}
+
+uint32_t candidate_priority(candidate_type type, uint16_t local_preference){
+    // component 1
+    return (type_preference(type) << 24) | (uint32_t{local_preference} << 8) | (256 - 1);
+}
+
+ice_candidate make_candidate(candidate_type type, net::ipv4 address, net::ipv4 base){
+    return ice_candidate{type, address, base, candidate_priority(type), (static_cast<uint64_t>(type) << 32) | base.net_address};
+}
+
+uint64_t pair_priority(uint32_t G, uint32_t D){
+    return (uint64_t{std::min(G, D)} << 32) + 2 * uint64_t{std::max(G, D)} + (G > D ? 1 : 0);
+}
+
+coro::lazy_task<std::expected<std::vector<ice_candidate>, std::string>> gather_candidates(client_udpv4& c, net::ipv4 server){
+    std::vector<ice_candidate> candidates{make_candidate(candidate_type::host, c.get_self_addr(), c.get_self_addr())};
+
+    auto mapped = co_await async_build_binding(c, server);
+    if (!mapped.has_value()) co_return std::unexpected(std::format("no server reflexive candidate: {}", mapped.error()));
+    // RFC 8445 5.1.3, the same address as the host candidate is redundant
+    if (mapped.value() != c.get_self_addr()){
+        candidates.push_back(make_candidate(candidate_type::server_reflexive, mapped.value(), c.get_self_addr()));
+    }
+    co_return candidates;
+}
+
+ice_checklist::ice_checklist(client_udpv4& socket, std::span<const ice_candidate> local, std::span<const ice_candidate> remote, ice_params params)
+    : socket{socket}, params{params} {
+    for (auto l : local){
+        // checks are sent from this socket only
+        if (l.base != socket.get_self_addr()) continue;
+        // 6.1.2.4: a server reflexive local candidate is checked from its base
+        if (l.type == candidate_type::server_reflexive){
+            l = make_candidate(candidate_type::host, l.base, l.base);
+        }
+        for (auto& r : remote){
+            auto priority = params.controlling ? pair_priority(l.priority, r.priority) : pair_priority(r.priority, l.priority);
+            pairs.push_back(candidate_pair{l, r, priority, pair_state::frozen, std::nullopt, std::nullopt});
+        }
+    }
+    std::ranges::stable_sort(pairs, std::ranges::greater{}, &candidate_pair::priority);
+
+    // the same base and remote address twice is redundant, the higher priority one stays
+    std::vector<candidate_pair> pruned;
+    for (auto& p : pairs){
+        auto redundant = std::ranges::any_of(pruned, [&](const candidate_pair& q){
+            return q.local.base == p.local.base && q.remote.address == p.remote.address;
+        });
+        if (!redundant && pruned.size() < params.max_pairs) pruned.push_back(p);
+    }
+    pairs = std::move(pruned);
+
+    // 6.1.2.6: the highest priority pair of each foundation starts waiting
+    for (size_t i = 0; i < pairs.size(); i++){
+        auto first = std::ranges::none_of(pairs.begin(), pairs.begin() + i, [&](const candidate_pair& q){
+            return same_foundation(q, pairs[i]);
+        });
+        if (first) pairs[i].state = pair_state::waiting;
+    }
+}
+
+std::optional<size_t> ice_checklist::next_check(){
+    for (size_t i = 0; i < pairs.size(); i++){
+        if (pairs[i].state == pair_state::waiting) return i;
+    }
+    for (size_t i = 0; i < pairs.size(); i++){
+        if (pairs[i].state == pair_state::frozen){
+            pairs[i].state = pair_state::waiting;
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+void ice_checklist::unfreeze(const candidate_pair& succeeded){
+    for (auto& p : pairs){
+        if (p.state == pair_state::frozen && same_foundation(p, succeeded)) p.state = pair_state::waiting;
+    }
+}
+
+coro::lazy_task<std::expected<ice_result, std::string>> ice_checklist::run(){
+    using clock_t = client_udpv4::clock_t;
+    if (pairs.empty()) co_return std::unexpected(std::format("no candidate pairs for {}", socket.get_self_addr().toString()));
+
+    auto start = clock_t::now();
+    auto tie_breaker = params.tie_breaker != 0 ? params.tie_breaker : math::random<uint64_t>(1, std::numeric_limits<uint64_t>::max());
+    ice_result result{{}, 0, 0, {}};
+    std::list<ice_check> in_flight;
+    bool found = false;
+
+    auto settle = [&](ice_check& check){
+        auto& pair = pairs[check.pair];
+        auto& res = check.task.get();
+        auto x_addr = res.has_value() && std::get<1>(res.value()).get_type() == (stun::msg_method::BINDING | stun::msg_type::SUCCESS_RESPONSE)
+            ? std::get<1>(res.value()).find_one<stun::ipv4_xor_mappedAddress>() : nullptr;
+        if (x_addr != nullptr){
+            pair.state = pair_state::succeeded;
+            pair.mapped = net::ipv4{x_addr->get_net_address(), x_addr->get_net_port()};
+            pair.rtt = socket.get_txn_manager()->rto.srtt(pair.remote.address);
+            unfreeze(pair);
+            found = true;
+        } else {
+            pair.state = pair_state::failed;
+            result.failed++;
+        }
+    };
+
+    while (true){
+        for (auto it = in_flight.begin(); it != in_flight.end();){
+            if (!it->task.done()){
+                ++it;
+                continue;
+            }
+            settle(*it);
+            it = in_flight.erase(it);
+        }
+        if (found && params.stop_at_first) break;
+
+        auto next = in_flight.size() < params.max_in_flight ? next_check() : std::nullopt;
+        if (next.has_value()){
+            pairs[*next].state = pair_state::in_progress;
+            in_flight.emplace_back(socket, *next, pairs[*next].remote.address, params, tie_breaker);
+            result.checks++;
+        } else if (in_flight.empty()){
+            break;
+        }
+        co_await coro::timer::delay_awaiter{params.Ta};
+    }
+
+    // only left over when stopping at the first valid pair
+    for (auto& check : in_flight){
+        socket.get_txn_manager()->onTimeout(check.msg.get_txn_id());
+    }
+    for (auto& check : in_flight){
+        co_await check.task;
+        if (check.task.get().has_value()){
+            settle(check);
+        } else {
+            pairs[check.pair].state = pair_state::waiting;
+        }
+    }
+
+    for (auto& p : pairs){
+        if (p.state == pair_state::succeeded) result.valid.push_back(p);
+    }
+    result.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start);
+    log::async().info("checklist on {}: {} checks, {} valid, {} failed\n",
+        socket.get_self_addr().toString(), result.checks, result.valid.size(), result.failed);
+    co_return result;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "client.h"
+
+enum class candidate_type : uint8_t
+{
+    host,
+    server_reflexive,
+    peer_reflexive
+};
+
+struct ice_candidate
+{
+    candidate_type type;
+    net::ipv4 address;
+    // the socket checks for this candidate are sent from
+    net::ipv4 base;
+    uint32_t priority;
+    // equal for candidates of the same type from the same base
+    uint64_t foundation;
+};
+
+// RFC 8445 5.1.2.1, one component
+uint32_t candidate_priority(candidate_type type, uint16_t local_preference = 65535);
+ice_candidate make_candidate(candidate_type type, net::ipv4 address, net::ipv4 base);
+
+// the socket's host candidate and, unless it is the same address, the
+// server reflexive one
+coro::lazy_task<std::expected<std::vector<ice_candidate>, std::string>> gather_candidates(client_udpv4& c, net::ipv4 server);
+
+struct ice_params
+{
+    // RFC 8445 14.2: one new check per Ta
+    std::chrono::milliseconds Ta{50};
+    // checks waiting for an answer at once
+    size_t max_in_flight = 8;
+    // RFC 8445 6.1.2.5
+    size_t max_pairs = 100;
+    // per check, gives up after 700ms: most pairs fail
+    retransmit_params check{3, 4, std::chrono::milliseconds{100}, std::chrono::milliseconds{100}, std::chrono::milliseconds{100}};
+    bool controlling = true;
+    uint64_t tie_breaker = 0;
+    // done at the first valid pair instead of checking them all
+    bool stop_at_first = false;
+};
+
+enum class pair_state : uint8_t
+{
+    frozen,
+    waiting,
+    in_progress,
+    succeeded,
+    failed
+};
+
+struct candidate_pair
+{
+    ice_candidate local;
+    ice_candidate remote;
+    uint64_t priority;
+    pair_state state;
+    // what the peer saw the check come from, set once succeeded
+    std::optional<net::ipv4> mapped;
+    std::optional<std::chrono::nanoseconds> rtt;
+};
+
+struct ice_result
+{
+    // succeeded pairs, highest priority first; the first is the one to use
+    std::vector<candidate_pair> valid;
+    size_t checks;
+    size_t failed;
+    std::chrono::nanoseconds elapsed;
+};
+
+// RFC 8445 6.1.2.3, G is the controlling agent's candidate priority
+uint64_t pair_priority(uint32_t G, uint32_t D);
+
+// One agent's checklist over a single socket. Pairs are formed, pruned and
+// ordered as in RFC 8445 6.1.2; run() then starts the highest priority
+// waiting check every Ta while fewer than max_in_flight are outstanding,
+// unfreezing by foundation as checks succeed. Nothing here owns a thread:
+// any number of checklists can share a socket, its reactor and the timer.
+class ice_checklist{
+private:
+    client_udpv4& socket;
+    ice_params params;
+    // highest priority first
+    std::vector<candidate_pair> pairs;
+
+    // the highest priority waiting pair, unfreezing one if there is none
+    std::optional<size_t> next_check();
+    void unfreeze(const candidate_pair& succeeded);
+
+public:
+    explicit ice_checklist(client_udpv4& socket, std::span<const ice_candidate> local, std::span<const ice_candidate> remote, ice_params params = {});
+    ice_checklist(const ice_checklist&) = delete;
+    ice_checklist& operator=(const ice_checklist&) = delete;
+
+    inline const std::vector<candidate_pair>& get_pairs() const { return pairs; }
+
+    // the checklist and the socket must outlive the task; the socket has
+    // to answer Binding requests for the peer's checks to succeed
+    coro::lazy_task<std::expected<ice_result, std::string>> run();
+};
@@ -1,11 +1,27 @@
 #include <cstdint>
 #include <iostream>
+#include <list>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include "nat_test.h"
+#include "nat_sim.h"
+#include "timer_bench.h"
+#include "discovery.h"
+#include "binding_manager.h"
+#include "port_prediction.h"
+#include "hole_punch.h"
+#include "ice.h"
+#include "monitor.h"
+#include "broker.h"
+#include "server_cache.h"
 #include "net/udpv4.h"
+#include "coro/threadpool.h"
+#include "coro/timer.h"
+#include "thread_config.h"
 #include "opts.h"
 #include "meta.h"
 using namespace seele;
@@ -23,13 +39,49 @@ int main(int argc, char* argv[]){
             opts::ruler::no_arg("--query-all-addr", "-q"),
             opts::ruler::opt_arg("--build-binding", "-b"),
             opts::ruler::no_arg("--nat-type", "-t"),
+            opts::ruler::no_arg("--retest", "-T"),
             opts::ruler::no_arg("--nat-lifetime", "-s"),
+            opts::ruler::req_arg("--lifetime-bindings", "-k"),
+            opts::ruler::req_arg("--lifetime-resolution", "-r"),
+            opts::ruler::req_arg("--keep-bindings", "-K"),
+            opts::ruler::opt_arg("--predict-ports", "-x"),
+            opts::ruler::opt_arg("--punch", "-H"),
+            opts::ruler::opt_arg("--ice", "-I"),
+            opts::ruler::opt_arg("--daemon", "-D"),
+            opts::ruler::req_arg("--verify-interval", "-v"),
+            opts::ruler::opt_arg("--broker", "-B"),
+            opts::ruler::opt_arg("--lease", "-L"),
             opts::ruler::req_arg("--interface_index", "-i"),
+            opts::ruler::req_arg("--server-list", "-f"),
+            opts::ruler::req_arg("--answers", "-n"),
+            opts::ruler::req_arg("--cache", "-c"),
+            opts::ruler::req_arg("--rc", "-R"),
+            opts::ruler::req_arg("--rm", "-M"),
+            opts::ruler::req_arg("--pace", "-p"),
+            opts::ruler::req_arg("--socket-pace", "-P"),
+            opts::ruler::req_arg("--workers", "-W"),
+            opts::ruler::req_arg("--worker-cpus", "-C"),
+            opts::ruler::req_arg("--io-cpus", "-O"),
+            opts::ruler::opt_arg("--nat-emulate", "-e"),
+            opts::ruler::opt_arg("--timer-bench", "-X"),
             opts::ruler::opt_arg("--log", "-l")
     );
     bool flag[256] = {};
     uint32_t interface_index = 0;
     uint16_t bind_port = 0;
+    size_t lifetime_bindings = 0;
+    lifetime_params lifetime_cfg{};
+    size_t keep_bindings = 0;
+    size_t port_samples = 256;
+    size_t punch_pairs = 1;
+    size_t ice_sessions = 1;
+    std::optional<std::chrono::seconds> keep_lifetime;
+    std::optional<std::string> state_path = default_state_path();
+    monitor_params monitor_cfg{};
+    std::optional<std::string> broker_path = default_broker_path();
+    std::string_view server_list;
+    size_t answers_wanted = 3;
+    std::optional<std::string> cache_path = default_cache_path();
     
     opts::pos_arg p_args;
 
@@ -45,9 +97,32 @@ int main(int argc, char* argv[]){
                     std::cout << std::format("Usage: {} <server_addr>\n options:\n", argv[0]);
                     std::cout << "  -b, --build-binding <bind_port>?: build binding by specified port\n";
                     std::cout << "  -i, --interface_index <index>: specify network interface index\n";
+                    std::cout << "  -f, --server-list <file>: race all servers in <file> and report the consensus public address\n";
+                    std::cout << "  -n, --answers <count>: answers to wait for with -f, default 3\n";
+                    std::cout << "  -c, --cache <file>: server health cache, default ~/.cache/stun-client.cache\n";
+                    std::cout << "  -R, --rc <count>: transmissions per request, default 7 (RFC 5389 Rc)\n";
+                    std::cout << "  -M, --rm <factor>: last wait in multiples of RTO, default 16 (RFC 5389 Rm)\n";
+                    std::cout << "  -p, --pace <rate>[:<burst>]: packets per second for the whole process, 0 for unpaced, default 2000:64\n";
+                    std::cout << "  -P, --socket-pace <rate>[:<burst>]: packets per second for each socket, default unpaced\n";
+                    std::cout << "  -W, --workers <count>: coroutine worker threads, default one per hardware thread\n";
+                    std::cout << "  -C, --worker-cpus <list>: pin the workers round-robin to the cpus in <list>, e.g. 2-5,8\n";
+                    std::cout << "  -O, --io-cpus <list>: run the reactor and timer threads on the cpus in <list> only\n";
                     std::cout << "  -t, --nat-type: test nat type\n";
+                    std::cout << "  -T, --retest: run the full nat type test even if a cached result is confirmed\n";
                     std::cout << "  -s, --nat-lifetime: test nat lifetime\n";
+                    std::cout << "  -k, --lifetime-bindings <count>: test nat lifetime with <count> bindings in parallel\n";
+                    std::cout << "  -r, --lifetime-resolution <seconds>: accuracy of the parallel lifetime test, default 15\n";
+                    std::cout << "  -K, --keep-bindings <count>[:<lifetime>]: hold <count> bindings open, refreshing them before <lifetime> seconds (default: measured with -s, else 30)\n";
+                    std::cout << "  -x, --predict-ports <samples>?: sample mapped ports from many sockets at once and predict the next one, default 256\n";
+                    std::cout << "  -H, --punch <pairs>?: punch <pairs> paths between two local peers, signalled in process, default 1\n";
+                    std::cout << "  -I, --ice <sessions>?: run <sessions> ICE checklists at once between one shared local socket and a socket per session, default 1\n";
+                    std::cout << "  -D, --daemon <state_file>?: keep watching the nat, -K sets the bindings kept, state goes to <state_file> (default $XDG_RUNTIME_DIR/stun-client.state)\n";
+                    std::cout << "  -v, --verify-interval <seconds>: between re-checks of the nat type with -D, default 300\n";
+                    std::cout << "  -B, --broker <socket_path>?: keep a pool of bindings (-K sets its size) and hand their sockets to local processes at <socket_path> (default $XDG_RUNTIME_DIR/stun-client.sock)\n";
+                    std::cout << "  -L, --lease <socket_path>?: take a socket from the broker at <socket_path> and check its mapping\n";
                     std::cout << "  -q, --query-all-addr: query all device ip\n";
+                    std::cout << "  -e, --nat-emulate <rounds>?: run nat test against the in-process nat emulator\n";
+                    std::cout << "  -X, --timer-bench <timers>?: time inserting, cancelling half of and expiring <timers> timers, default 1000000\n";
                     std::cout << "  -l, --log <file_name>?: enable log\n";
                     std::exit(0);
                 }
@@ -63,6 +138,9 @@ int main(int argc, char* argv[]){
                 else if (arg.long_name == "--nat-type") {
                     flag['t'] = true;
                 }
+                else if (arg.long_name == "--retest") {
+                    flag['T'] = true;
+                }
                 else if (arg.long_name == "--nat-lifetime") {
                     flag['s'] = true;
                 }
@@ -76,6 +154,88 @@ int main(int argc, char* argv[]){
                         std::exit(1);
                     }
                     interface_index = e.value();
+                } else if (arg.long_name == "--server-list") {
+                    flag['f'] = true;
+                    server_list = arg.value;
+                } else if (arg.long_name == "--cache") {
+                    cache_path = std::string(arg.value);
+                } else if (arg.long_name == "--rc" || arg.long_name == "--rm") {
+                    auto e = math::stoi(arg.value);
+                    if (!e.has_value() || e.value() == 0) {
+                        std::cout << std::format("invalid {}: {}\n", arg.long_name, arg.value);
+                        std::exit(1);
+                    }
+                    (arg.long_name == "--rc" ? default_retransmit_params().Rc : default_retransmit_params().Rm) = e.value();
+                } else if (arg.long_name == "--pace" || arg.long_name == "--socket-pace") {
+                    std::string_view v = arg.value;
+                    auto sep = v.find(':');
+                    auto rate = math::stoi(v.substr(0, sep));
+                    auto burst = sep == std::string_view::npos ? std::expected<uint32_t, char>{1} : math::stoi(v.substr(sep + 1));
+                    if (!rate.has_value() || !burst.has_value() || burst.value() == 0) {
+                        std::cout << std::format("invalid {}: {}\n", arg.long_name, arg.value);
+                        std::exit(1);
+                    }
+                    (arg.long_name == "--pace" ? default_global_pacing() : default_socket_pacing()) =
+                        pacing{static_cast<double>(rate.value()), burst.value()};
+                } else if (arg.long_name == "--workers") {
+                    auto e = math::stoi(arg.value);
+                    if (!e.has_value() || e.value() == 0) {
+                        std::cout << std::format("invalid worker count: {}\n", arg.value);
+                        std::exit(1);
+                    }
+                    coro::thread::default_pool_config().workers = e.value();
+                } else if (arg.long_name == "--worker-cpus" || arg.long_name == "--io-cpus") {
+                    auto cpus = parse_cpu_list(arg.value);
+                    if (!cpus.has_value()) {
+                        std::cout << std::format("invalid {}: {}\n", arg.long_name, cpus.error());
+                        std::exit(1);
+                    }
+                    if (arg.long_name == "--worker-cpus") {
+                        coro::thread::default_pool_config().cpus = std::move(cpus.value());
+                    } else {
+                        net::default_reactor_thread().cpus = cpus.value();
+                        coro::timer::default_timer_thread().cpus = std::move(cpus.value());
+                    }
+                } else if (arg.long_name == "--answers") {
+                    auto e = math::stoi(arg.value);
+                    if (!e.has_value() || e.value() == 0) {
+                        std::cout << std::format("invalid answer count: {}\n", arg.value);
+                        std::exit(1);
+                    }
+                    answers_wanted = e.value();
+                } else if (arg.long_name == "--lifetime-bindings") {
+                    auto e = math::stoi(arg.value);
+                    if (!e.has_value() || e.value() == 0) {
+                        std::cout << std::format("invalid binding count: {}\n", arg.value);
+                        std::exit(1);
+                    }
+                    lifetime_bindings = e.value();
+                } else if (arg.long_name == "--keep-bindings") {
+                    std::string_view v = arg.value;
+                    auto sep = v.find(':');
+                    auto count = math::stoi(v.substr(0, sep));
+                    auto lifetime = sep == std::string_view::npos ? std::expected<uint32_t, char>{30} : math::stoi(v.substr(sep + 1));
+                    if (!count.has_value() || count.value() == 0 || !lifetime.has_value() || lifetime.value() == 0) {
+                        std::cout << std::format("invalid {}: {}\n", arg.long_name, arg.value);
+                        std::exit(1);
+                    }
+                    flag['K'] = true;
+                    keep_bindings = count.value();
+                    if (sep != std::string_view::npos) keep_lifetime = std::chrono::seconds{lifetime.value()};
+                } else if (arg.long_name == "--verify-interval") {
+                    auto e = math::stoi(arg.value);
+                    if (!e.has_value() || e.value() == 0) {
+                        std::cout << std::format("invalid interval: {}\n", arg.value);
+                        std::exit(1);
+                    }
+                    monitor_cfg.verify_interval = std::chrono::seconds{e.value()};
+                } else if (arg.long_name == "--lifetime-resolution") {
+                    auto e = math::stoi(arg.value);
+                    if (!e.has_value() || e.value() == 0) {
+                        std::cout << std::format("invalid resolution: {}\n", arg.value);
+                        std::exit(1);
+                    }
+                    lifetime_cfg.resolution = std::chrono::seconds{e.value()};
                 }
             },
             [&](opts::opt_arg& arg) {
@@ -91,8 +251,82 @@ int main(int argc, char* argv[]){
                     } else {
                         bind_port = net::random_pri_iana_net_port();
                     }
+                } else if (arg.long_name == "--predict-ports") {
+                    flag['x'] = true;
+                    if (arg.value.has_value()) {
+                        auto e = math::stoi(arg.value.value());
+                        if (!e.has_value() || e.value() < 2) {
+                            std::cout << std::format("invalid sample count: {}\n", arg.value.value());
+                            std::exit(1);
+                        }
+                        port_samples = e.value();
+                    }
+                } else if (arg.long_name == "--punch") {
+                    flag['H'] = true;
+                    if (arg.value.has_value()) {
+                        auto e = math::stoi(arg.value.value());
+                        if (!e.has_value() || e.value() == 0) {
+                            std::cout << std::format("invalid pair count: {}\n", arg.value.value());
+                            std::exit(1);
+                        }
+                        punch_pairs = e.value();
+                    }
+                } else if (arg.long_name == "--ice") {
+                    flag['I'] = true;
+                    if (arg.value.has_value()) {
+                        auto e = math::stoi(arg.value.value());
+                        if (!e.has_value() || e.value() == 0) {
+                            std::cout << std::format("invalid session count: {}\n", arg.value.value());
+                            std::exit(1);
+                        }
+                        ice_sessions = e.value();
+                    }
+                } else if (arg.long_name == "--daemon") {
+                    flag['D'] = true;
+                    if (arg.value.has_value()) state_path = std::string(arg.value.value());
+                } else if (arg.long_name == "--broker") {
+                    flag['B'] = true;
+                    if (arg.value.has_value()) broker_path = std::string(arg.value.value());
+                } else if (arg.long_name == "--lease") {
+                    flag['L'] = true;
+                    if (arg.value.has_value()) broker_path = std::string(arg.value.value());
+                } else if (arg.long_name == "--nat-emulate") {
+                    size_t rounds = 1;
+                    if (arg.value.has_value()) {
+                        auto e = math::stoi(arg.value.value());
+                        if (!e.has_value() || e.value() == 0) {
+                            std::cout << std::format("invalid rounds: {}\n", arg.value.value());
+                            std::exit(1);
+                        }
+                        rounds = e.value();
+                    }
+                    auto report = sim::run_scenarios(rounds, 0);
+                    for (auto& failure : report.failures) {
+                        std::cout << failure << "\n";
+                    }
+                    auto ms = std::chrono::duration<double, std::milli>(report.elapsed).count();
+                    std::cout << std::format("emulated {} scenarios in {:.1f}ms ({:.0f}/s), {} mismatched\n",
+                        report.total, ms, report.total / (ms / 1000), report.mismatched);
+                    std::exit(report.mismatched == 0 ? 0 : 1);
+                } else if (arg.long_name == "--timer-bench") {
+                    size_t count = 1000000;
+                    if (arg.value.has_value()) {
+                        auto e = math::stoi(arg.value.value());
+                        if (!e.has_value() || e.value() < 2) {
+                            std::cout << std::format("invalid timer count: {}\n", arg.value.value());
+                            std::exit(1);
+                        }
+                        count = e.value();
+                    }
+                    for (auto& r : bench::run_timer_bench(count, 0)) {
+                        auto per = [&](std::chrono::nanoseconds t, size_t n){ return static_cast<double>(t.count()) / n; };
+                        std::cout << std::format("{:<14} insert {:>7.1f}ns  cancel {:>7.1f}ns  expire {:>7.1f}ns  ({} expired)\n",
+                            r.name, per(r.insert, count), per(r.cancel, (count + 1) / 2), per(r.expire, r.expired), r.expired);
+                    }
+                    std::exit(0);
                 } else if (arg.long_name == "--log") {
                     log::logger().set_enable(true);
+                    txn_registry::get_instance().set_enable(true);
                     if (arg.value.has_value()) {
                         log::logger().set_output_file(arg.value.value());
                     } else {
@@ -109,7 +343,17 @@ int main(int argc, char* argv[]){
 
 
 
-    std::expected<net::ipv4, std::string> server_addr;
+    std::optional<server_cache> cache;
+    if (cache_path.has_value()){
+        auto res = server_cache::open(cache_path.value());
+        if (res.has_value()){
+            cache.emplace(std::move(res.value()));
+        } else {
+            log::sync().warn("{}, continuing without it\n", res.error());
+        }
+    }
+
+    std::expected<net::ipv4, std::string> server_addr = std::unexpected("missing server address");
     
     if (p_args.values.size() == 1){
         server_addr = net::parse_addr(*p_args.values.begin());
@@ -117,9 +361,14 @@ int main(int argc, char* argv[]){
             std::cout << server_addr.error() << std::endl;
             return 1;
         }
-    } else {
-        std::cout << "missing server address, use -h for help\n";
-        return 1;
+    } else if (!flag['f']) {
+        auto best = cache.has_value() ? cache->best(flag['t'] || flag['s']) : std::nullopt;
+        if (!best.has_value()){
+            std::cout << "missing server address, use -h for help\n";
+            return 1;
+        }
+        server_addr = best->server();
+        std::cout << std::format("using cached server {} ({:.1f}ms)\n", best->server().toString(), best->srtt_us / 1000.0);
     }
 
     uint32_t bind_addr = 0;
@@ -136,29 +385,340 @@ int main(int argc, char* argv[]){
         std::cout << std::format("auto detected network interface address: {}\n", net::inet_ntoa(bind_addr));
     }
 
+    if (flag['f']){
+        auto servers = load_server_list(server_list);
+        if (!servers.has_value()){
+            std::cout << servers.error() << std::endl;
+            return 1;
+        }
+
+        // servers known to be fast are asked first
+        auto ranked = cache.has_value() ? cache->rank(servers.value()) : std::move(servers.value());
+
+        // gone by the end of this block, the servers that did not answer
+        // in time are abandoned by collect()
+        clientImpl race_client{bind_addr, net::random_pri_iana_net_port()};
+        server_race<clientImpl> race{race_client, ranked};
+        auto res = race.collect(answers_wanted);
+        if (!res.has_value()){
+            // collect only gives up once every probe has finished
+            if (cache.has_value()){
+                for (auto& server : ranked) cache->record_failure(server);
+            }
+            std::cout << res.error() << std::endl;
+            return 1;
+        }
+
+        auto& result = res.value();
+        if (cache.has_value()){
+            for (auto& answer : result.answers) cache->record_success(answer.server, answer.behavior_discovery, answer.rtt);
+            for (auto& server : result.failed) cache->record_failure(server);
+        }
+        std::cout << std::format("public address: {} ({}/{} servers agree)\n", result.mapped.toString(), result.agreeing, result.answers.size());
+        for (auto& answer : result.answers){
+            std::cout << std::format("  {:<21} {:>10} {}{}\n",
+                answer.server.toString(),
+                answer.rtt.has_value() ? std::format("{:.1f}ms", std::chrono::duration<double, std::milli>(answer.rtt.value()).count()) : "unknown",
+                answer.mapped.toString(),
+                answer.behavior_discovery ? " rfc5780" : "");
+        }
+
+        if (!server_addr.has_value()){
+            // answers arrive in the order they were paced out, so pick by
+            // RTT, among rfc5780 servers when there are any
+            auto better = [](const server_answer& a, const server_answer& b){
+                if (a.behavior_discovery != b.behavior_discovery) return a.behavior_discovery;
+                return a.rtt.value_or(std::chrono::nanoseconds::max()) < b.rtt.value_or(std::chrono::nanoseconds::max());
+            };
+            auto it = std::ranges::min_element(result.answers, better);
+            if (!it->behavior_discovery && (flag['t'] || flag['s'])){
+                std::cout << "no answering server supports rfc5780, nat type and lifetime tests need one\n";
+                return 1;
+            }
+            server_addr = it->server;
+            std::cout << std::format("using fastest server {}\n", it->server.toString());
+        }
+    }
+
 
     if (flag['s']){
         std::cout << "it may take a while to test nat lifetime, please wait...\n";
 
-        clientImpl X{bind_addr, net::random_pri_iana_net_port()}, Y{bind_addr, net::random_pri_iana_net_port()};
-        auto res = lifetime_test(X, Y, server_addr.value());
+        // one reactor serves every binding instead of a listener thread each
+        net::reactor reactor;
+        auto res = discover_nat(nat_discovery_config<clientImpl>{
+            server_addr.value(), open_on(bind_addr, &reactor), nullptr, nullptr,
+            false, true, lifetime_bindings, lifetime_cfg
+        }).get_as_rvalue();
 
         if (res.has_value()){
-            std::cout << std::format("nat lifetime: {}s\n", res.value());
+            std::cout << std::format("nat lifetime: {}s\n", res->lifetime.value());
+            if (!keep_lifetime.has_value()) keep_lifetime = std::chrono::seconds{res->lifetime.value()};
         } else {
             std::cout << res.error() << std::endl;
         }
     }
-    if (flag['t']){
-        clientImpl c{bind_addr, flag['b'] ? bind_port : net::random_pri_iana_net_port()};
+    if (flag['D']){
+        if (flag['K']) monitor_cfg.bindings = keep_bindings;
+        if (keep_lifetime.has_value()) monitor_cfg.keepalive.lifetime = keep_lifetime.value();
+        nat_monitor monitor{server_addr.value(), bind_addr, cache.has_value() ? &cache.value() : nullptr, monitor_cfg};
+        monitor.set_on_state([&](const monitor_state& state){
+            std::cout << std::format("public address {}, {} of {} bindings mapped, {} mapping changes, {}{}\n",
+                state.public_address.has_value() ? state.public_address->toString() : "unknown",
+                state.mapped, state.bindings, state.mapping_changes,
+                state.type.has_value() ? describe(state.type.value()) : "nat type unknown",
+                state.error.empty() ? "" : std::format(", {}", state.error));
+            if (!state_path.has_value()) return;
+            if (auto res = write_state(state_path.value(), state); !res.has_value()){
+                log::sync().warn("{}\n", res.error());
+            }
+        });
+        if (auto res = monitor.start(); !res.has_value()){
+            std::cout << res.error() << std::endl;
+            return 1;
+        }
 
-        auto res = nat_test(c, server_addr.value());
-    
-    
-        if (!res.has_value()){
+        // runs until interrupted
+        std::cout << std::format("watching the nat through {} within {}s keepalives, verifying every {}s{}\n",
+            server_addr.value().toString(), monitor_cfg.keepalive.lifetime.count(), monitor_cfg.verify_interval.count(),
+            state_path.has_value() ? std::format(", state in {}", state_path.value()) : "");
+        while (true){
+            std::this_thread::sleep_for(std::chrono::hours{1});
+        }
+    }
+    if (flag['B'] || flag['L']){
+        if (!broker_path.has_value()){
+            std::cout << "no broker socket path, give one or set XDG_RUNTIME_DIR\n";
+            return 1;
+        }
+    }
+    if (flag['B']){
+        broker_params params{};
+        if (flag['K']) params.pool = keep_bindings;
+        if (keep_lifetime.has_value()) params.keepalive.lifetime = keep_lifetime.value();
+        binding_broker broker{server_addr.value(), bind_addr, broker_path.value(), params};
+        if (auto res = broker.start(); !res.has_value()){
             std::cout << res.error() << std::endl;
             return 1;
         }
+
+        // runs until interrupted
+        std::cout << std::format("leasing bindings to {} at {}, {} kept ready\n", server_addr.value().toString(), broker_path.value(), params.pool);
+        while (true){
+            std::this_thread::sleep_for(std::chrono::seconds{10});
+            auto t = broker.totals();
+            std::cout << std::format("{} of {} pooled bindings mapped, {} leased\n", t.mapped, t.bindings, broker.get_leased());
+        }
+    }
+    if (flag['L']){
+        auto start = std::chrono::steady_clock::now();
+        auto lease = lease_socket(broker_path.value());
+        auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (!lease.has_value()){
+            std::cout << lease.error() << std::endl;
+            return 1;
+        }
+        std::cout << std::format("leased {} mapped to {} in {:.0f}us, refreshed {}ms ago, lifetime {}s\n",
+            lease->local.toString(), lease->mapped.toString(), elapsed,
+            lease->refreshed_ago.count(), std::chrono::duration_cast<std::chrono::seconds>(lease->lifetime).count());
+
+        // the mapping has to be the one the broker saw
+        net::reactor reactor;
+        clientImpl c{std::move(lease->socket), lease->local, nullptr, &reactor};
+        auto mapped = build_binding(c, server_addr.value());
+        if (!mapped.has_value()){
+            std::cout << mapped.error() << std::endl;
+            return 1;
+        }
+        std::cout << std::format("server sees {}{}\n", mapped->toString(), mapped.value() == lease->mapped ? "" : ", the mapping moved");
+        return mapped.value() == lease->mapped ? 0 : 1;
+    }
+    if (flag['K']){
+        keepalive_params params{};
+        if (keep_lifetime.has_value()) params.lifetime = keep_lifetime.value();
+        binding_manager manager{server_addr.value(), bind_addr, params};
+        for (size_t i = 0; i < keep_bindings; i++){
+            if (auto id = manager.open(); !id.has_value()){
+                std::cout << std::format("{} after {} bindings\n", id.error(), i);
+                break;
+            }
+        }
+
+        // runs until interrupted
+        std::cout << std::format("refreshing bindings to {} within {}s\n", server_addr.value().toString(), params.lifetime.count());
+        while (true){
+            std::this_thread::sleep_for(std::chrono::seconds{10});
+            auto t = manager.totals();
+            std::cout << std::format("{} bindings: {} mapped, {} failing, {} mapping changes\n", t.bindings, t.mapped, t.failing, t.changes);
+        }
+    }
+
+    if (flag['x']){
+        // declared first, outlives every socket on it
+        net::reactor reactor;
+        auto txns = std::make_shared<clientImpl::txn_manager>();
+        std::vector<std::unique_ptr<clientImpl>> owned;
+        std::vector<clientImpl*> sockets;
+        // random ports collide now and then
+        for (size_t attempts = 0; sockets.size() < port_samples && attempts < 2 * port_samples; attempts++){
+            if (auto c = clientImpl::open(bind_addr, net::random_pri_iana_net_port(), txns, &reactor); c.has_value()){
+                sockets.push_back(owned.emplace_back(std::move(c.value())).get());
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto samples = sample_ports<clientImpl>(sockets, server_addr.value()).get_as_rvalue();
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (!samples.has_value()){
+            std::cout << samples.error() << std::endl;
+            return 1;
+        }
+
+        std::cout << std::format("{} of {} sockets mapped in {:.1f}ms\n", samples->size(), sockets.size(), elapsed);
+        std::cout << describe(predict_ports(samples.value())) << "\n";
+        return 0;
+    }
+
+    if (flag['H']){
+        using punch_task = coro::lazy_task<std::expected<punch_result, std::string>>;
+        struct side{
+            punch_task task;
+            side(hole_puncher& puncher, signalling signal) : task{puncher.punch(std::move(signal))} {}
+        };
+
+        hole_puncher puncher{server_addr.value(), bind_addr};
+        loopback_signalling channels;
+        std::list<side> sides;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < punch_pairs; i++){
+            sides.emplace_back(puncher, channels.channel(std::to_string(i)));
+            sides.emplace_back(puncher, channels.channel(std::to_string(i)));
+        }
+
+        // every socket is kept until both sides are done, the peer may still be checking
+        size_t punched = 0;
+        for (auto& s : sides){
+            auto& res = s.task.get();
+            if (!res.has_value()){
+                std::cout << res.error() << std::endl;
+                continue;
+            }
+            punched++;
+            std::cout << std::format("{} ({}) -> {}, rtt {:.2f}ms, {} candidates\n",
+                res->socket->get_self_addr().toString(), res->mapped.toString(), res->remote.toString(),
+                std::chrono::duration<double, std::milli>(res->rtt).count(), res->candidates);
+        }
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << std::format("{} of {} sides punched in {:.1f}ms\n", punched, sides.size(), elapsed);
+        return punched == sides.size() ? 0 : 1;
+    }
+
+    if (flag['I']){
+        using gather_task = coro::lazy_task<std::expected<std::vector<ice_candidate>, std::string>>;
+        using run_task = coro::lazy_task<std::expected<ice_result, std::string>>;
+        struct peer{
+            std::unique_ptr<clientImpl> socket;
+            gather_task gathered;
+            peer(std::unique_ptr<clientImpl> s, net::ipv4 server) : socket{std::move(s)}, gathered{gather_candidates(*socket, server)} {}
+        };
+        struct session{
+            ice_checklist checklist;
+            run_task task;
+            session(clientImpl& socket, std::span<const ice_candidate> local, std::span<const ice_candidate> remote, ice_params params)
+                : checklist{socket, local, remote, params}, task{checklist.run()} {}
+        };
+
+        // declared first, outlives every socket on it
+        net::reactor reactor;
+        std::list<peer> peers;
+        for (size_t i = 0; i <= ice_sessions; i++){
+            // random ports collide now and then
+            auto c = clientImpl::open(bind_addr, net::random_pri_iana_net_port(), nullptr, &reactor);
+            for (int attempt = 0; attempt < 8 && !c.has_value(); attempt++){
+                c = clientImpl::open(bind_addr, net::random_pri_iana_net_port(), nullptr, &reactor);
+            }
+            if (!c.has_value()){
+                std::cout << c.error() << std::endl;
+                return 1;
+            }
+            c.value()->set_answer_binding(true);
+            peers.emplace_back(std::move(c.value()), server_addr.value());
+        }
+        for (auto& p : peers){
+            if (auto& g = p.gathered.get(); !g.has_value()){
+                std::cout << g.error() << std::endl;
+                return 1;
+            }
+        }
+
+        // the first socket is shared by every session on the controlling side
+        auto& shared = peers.front();
+        auto start = std::chrono::steady_clock::now();
+        std::list<session> sessions;
+        for (auto it = std::next(peers.begin()); it != peers.end(); ++it){
+            auto& own = it->gathered.get().value();
+            auto& theirs = shared.gathered.get().value();
+            sessions.emplace_back(*shared.socket, theirs, own, ice_params{.controlling = true});
+            sessions.emplace_back(*it->socket, own, theirs, ice_params{.controlling = false});
+        }
+
+        size_t valid = 0, checks = 0;
+        for (auto& s : sessions){
+            auto& res = s.task.get();
+            if (!res.has_value()){
+                std::cout << res.error() << std::endl;
+                continue;
+            }
+            checks += res->checks;
+            if (!res->valid.empty()) valid++;
+        }
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << std::format("{} of {} checklists found a valid pair, {} checks in {:.1f}ms\n", valid, sessions.size(), checks, elapsed);
+        if (auto& first = sessions.front().task.get(); first.has_value() && !first->valid.empty()){
+            auto& p = first->valid.front();
+            std::cout << std::format("selected {} -> {}, priority {}, rtt {}\n", p.local.address.toString(), p.remote.address.toString(), p.priority,
+                p.rtt.has_value() ? std::format("{:.2f}ms", std::chrono::duration<double, std::milli>(p.rtt.value()).count()) : "unknown");
+        }
+        return valid == sessions.size() ? 0 : 1;
+    }
+
+    if (flag['t']){
+        clientImpl c{bind_addr, flag['b'] ? bind_port : net::random_pri_iana_net_port()},
+                   aux{bind_addr, net::random_pri_iana_net_port()};
+
+        // a result measured behind this interface and gateway is reused as
+        // long as one Binding still shows the same public address
+        constexpr std::chrono::hours nat_cache_ttl{24};
+        uint32_t gateway = net::query_default_gateway();
+        std::expected<nat_type, std::string> res = std::unexpected("nat type not tested");
+        if (cache.has_value() && !flag['T']){
+            if (auto cached = cache->find_nat(bind_addr, gateway, nat_cache_ttl); cached != nullptr){
+                auto mapped = build_binding(c, server_addr.value());
+                if (mapped.has_value() && mapped->net_address == cached->public_address){
+                    res = nat_type{cached->filtering_type, cached->mapping_type,
+                        static_cast<hairpinning>(cached->hairpinning()), static_cast<fragment_handling>(cached->fragments())};
+                    std::cout << std::format("cached nat type confirmed, public address {}\n", net::inet_ntoa(cached->public_address));
+                } else {
+                    cache->forget_nat(bind_addr, gateway);
+                }
+            }
+        }
+
+        if (!res.has_value()){
+            res = nat_test(c, aux, server_addr.value());
+            if (!res.has_value()){
+                if (cache.has_value()) cache->record_failure(server_addr.value());
+                std::cout << res.error() << std::endl;
+                return 1;
+            }
+            if (cache.has_value()){
+                if (auto mapped = build_binding(c, server_addr.value()); mapped.has_value()){
+                    cache->record_nat(bind_addr, gateway, mapped->net_address, res->mapping_type, res->filtering_type,
+                        static_cast<uint8_t>(res->hairpin), static_cast<uint8_t>(res->fragments));
+                }
+            }
+        }
+        if (cache.has_value()) cache->record_success(server_addr.value(), true, std::nullopt);
     
         auto nat = res.value();
     
@@ -219,6 +779,37 @@ int main(int argc, char* argv[]){
             break;
         }
 
+        std::cout << "hairpinning: ";
+        switch (nat.hairpin)
+        {
+        case hairpinning::supported:
+            std::cout << "supported\n";
+            break;
+        case hairpinning::unsupported:
+            std::cout << "unsupported\n";
+            break;
+        default:
+            std::cout << "unknown\n";
+            break;
+        }
+
+        std::cout << "fragments: ";
+        switch (nat.fragments)
+        {
+        case fragment_handling::passed:
+            std::cout << "passed both ways\n";
+            break;
+        case fragment_handling::outbound:
+            std::cout << "passed outbound, server does not pad responses\n";
+            break;
+        case fragment_handling::dropped:
+            std::cout << "dropped\n";
+            break;
+        default:
+            std::cout << "unknown\n";
+            break;
+        }
+
         if (flag['b']){
             auto res = build_binding(c, server_addr.value());
             if (!res.has_value()){
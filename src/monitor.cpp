@@ -0,0 +1,264 @@
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+
+#include "monitor.h"
+#include "log.h"
+
+namespace {
+    int64_t unix_now(){
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::string_view mapping_name(uint8_t mapping){
+        switch (mapping){
+            case endpoint_independent_mapping: return "EIM";
+            case address_dependent_mapping: return "ADM";
+            case address_and_port_dependent_mapping: return "APDM";
+            case no_nat_mapping: return "none";
+            default: return "unknown";
+        }
+    }
+
+    std::string_view filtering_name(uint8_t filtering){
+        switch (filtering){
+            case endpoint_independent_filtering: return "EIF";
+            case address_dependent_filtering: return "ADF";
+            case address_and_port_dependent_filtering: return "APDF";
+            default: return "unknown";
+        }
+    }
+
+    std::string_view hairpin_name(hairpinning h){
+        switch (h){
+            case hairpinning::supported: return "supported";
+            case hairpinning::unsupported: return "unsupported";
+            default: return "unknown";
+        }
+    }
+
+    std::string_view fragments_name(fragment_handling f){
+        switch (f){
+            case fragment_handling::passed: return "passed";
+            case fragment_handling::outbound: return "outbound";
+            case fragment_handling::dropped: return "dropped";
+            default: return "unknown";
+        }
+    }
+}
+
+std::string describe(const nat_type& type){
+    return std::format("mapping={} filtering={} hairpinning={} fragments={}",
+        mapping_name(type.mapping_type), filtering_name(type.filtering_type), hairpin_name(type.hairpin), fragments_name(type.fragments));
+}
+
+std::string format_state(const monitor_state& s){
+    std::string out;
+    out += std::format("server={}\n", s.server.toString());
+    out += std::format("public_address={}\n", s.public_address.has_value() ? s.public_address->toString() : "");
+    out += std::format("mapping={}\n", s.type.has_value() ? mapping_name(s.type->mapping_type) : "unknown");
+    out += std::format("filtering={}\n", s.type.has_value() ? filtering_name(s.type->filtering_type) : "unknown");
+    out += std::format("hairpinning={}\n", s.type.has_value() ? hairpin_name(s.type->hairpin) : "unknown");
+    out += std::format("fragments={}\n", s.type.has_value() ? fragments_name(s.type->fragments) : "unknown");
+    out += std::format("bindings={}\n", s.bindings);
+    out += std::format("mapped={}\n", s.mapped);
+    out += std::format("mapping_changes={}\n", s.mapping_changes);
+    out += std::format("verifications={}\n", s.verifications);
+    out += std::format("retests={}\n", s.retests);
+    out += std::format("verified_at={}\n", s.verified_at);
+    out += std::format("changed_at={}\n", s.changed_at);
+    out += std::format("error={}\n", s.error);
+    return out;
+}
+
+std::expected<void, std::string> write_state(const std::string& path, const monitor_state& state){
+    auto tmp = path + ".tmp";
+    {
+        std::ofstream out{tmp, std::ios::trunc};
+        if (!out) return std::unexpected(std::format("failed to open {}", tmp));
+        out << format_state(state);
+        if (!out.flush()) return std::unexpected(std::format("failed to write {}", tmp));
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) return std::unexpected(std::format("failed to replace {}: {}", path, ec.message()));
+    return {};
+}
+
+std::optional<std::string> default_state_path(){
+    #if defined(_WIN32) || defined(_WIN64)
+    if (auto dir = std::getenv("LOCALAPPDATA"); dir != nullptr && *dir != 0){
+        return std::format("{}\\stun-client.state", dir);
+    }
+    #elif defined(__linux__)
+    if (auto dir = std::getenv("XDG_RUNTIME_DIR"); dir != nullptr && *dir != 0){
+        return std::format("{}/stun-client.state", dir);
+    }
+    #endif
+    return std::nullopt;
+}
+
+nat_monitor::nat_monitor(net::ipv4 server, uint32_t bind_address, server_cache* cache, monitor_params params)
+    : server{server}, bind_address{bind_address}, cache{cache}, params{params},
+      state{server, std::nullopt, std::nullopt, 0, 0, 0, 0, 0, 0, 0, {}}, moved{false},
+      manager{server, bind_address, params.keepalive} {}
+
+nat_monitor::~nat_monitor(){
+    worker.request_stop();
+    if (worker.joinable()) worker.join();
+}
+
+std::expected<void, std::string> nat_monitor::start(){
+    // binding 0 is opened first, its mapped address is the public address
+    manager.set_on_change([this](binding_manager::binding_id id, std::optional<net::ipv4> previous, net::ipv4 mapped){
+        std::lock_guard lock{m};
+        if (previous.has_value()){
+            state.changed_at = unix_now();
+        }
+        if (id == 0){
+            state.public_address = mapped;
+        }
+        // a new address may be a new NAT; binding 0's first answer is what
+        // the first verification waits for
+        if (previous.has_value() || id == 0){
+            moved = true;
+            cv.notify_all();
+        }
+    });
+
+    for (size_t i = 0; i < params.bindings; i++){
+        if (auto id = manager.open(); !id.has_value()){
+            if (i == 0) return std::unexpected(id.error());
+            log::async().warn("{} after {} bindings\n", id.error(), i);
+            break;
+        }
+    }
+
+    worker = std::jthread{[this](std::stop_token st){ run(st); }};
+    return {};
+}
+
+monitor_state nat_monitor::snapshot(){
+    auto t = manager.totals();
+    std::lock_guard lock{m};
+    auto s = state;
+    s.bindings = t.bindings;
+    s.mapped = t.mapped;
+    s.mapping_changes = t.changes;
+    return s;
+}
+
+void nat_monitor::publish(){
+    if (on_state) on_state(snapshot());
+}
+
+void nat_monitor::run(std::stop_token st){
+    using clock_t = std::chrono::steady_clock;
+    // the first verification waits for the first binding to answer, but not forever
+    auto next = clock_t::now() + params.verify_interval;
+    while (!st.stop_requested()){
+        bool changed;
+        {
+            std::unique_lock lock{m};
+            cv.wait_until(lock, st, next, [&]{ return moved; });
+            if (st.stop_requested()) return;
+            changed = std::exchange(moved, false);
+        }
+        if (changed) publish();
+        if (changed || clock_t::now() >= next){
+            verify();
+            publish();
+            next = clock_t::now() + params.verify_interval;
+        }
+    }
+}
+
+void nat_monitor::verify(){
+    std::optional<nat_type> known;
+    std::optional<net::ipv4> public_address;
+    {
+        std::lock_guard lock{m};
+        known = state.type;
+        public_address = state.public_address;
+    }
+
+    // a cached type counts only behind the same gateway and public address
+    uint32_t gateway = net::query_default_gateway();
+    if (!known.has_value() && cache != nullptr && public_address.has_value()){
+        if (auto cached = cache->find_nat(bind_address, gateway, params.cache_ttl);
+            cached != nullptr && cached->public_address == public_address->net_address){
+            known = nat_type{cached->filtering_type, cached->mapping_type,
+                static_cast<hairpinning>(cached->hairpinning()), static_cast<fragment_handling>(cached->fragments())};
+        }
+    }
+
+    // random ports collide now and then
+    auto open = [&]{
+        std::expected<std::unique_ptr<clientImpl>, std::string> opened = std::unexpected("no port tried");
+        for (int i = 0; i < 8 && !opened.has_value(); i++){
+            opened = clientImpl::open(bind_address, net::random_pri_iana_net_port(), nullptr, &reactor);
+        }
+        return opened;
+    };
+    auto c = open(), aux = open();
+    if (!c.has_value() || !aux.has_value()){
+        std::lock_guard lock{m};
+        state.error = c.has_value() ? aux.error() : c.error();
+        return;
+    }
+
+    std::optional<nat_type> measured;
+    std::string error;
+    bool retest = !known.has_value();
+    if (known.has_value()){
+        auto res = async_verify_nat_type(*c.value(), *aux.value(), server, known.value(), params.verify_schedule).get_as_rvalue();
+        if (!res.has_value()){
+            error = res.error();
+        } else if (res.value()){
+            measured = known;
+        } else {
+            log::async().warn("nat type behind {} no longer holds, testing in full\n", net::inet_ntoa(bind_address));
+            retest = true;
+        }
+    }
+    // c has only talked to the primary address, so its filters are as fresh as a new socket's
+    if (retest){
+        auto res = nat_test(*c.value(), *aux.value(), server);
+        if (res.has_value()){
+            measured = res.value();
+        } else {
+            error = res.error();
+        }
+    }
+
+    auto now = unix_now();
+    {
+        std::lock_guard lock{m};
+        state.verifications += known.has_value();
+        state.retests += retest && measured.has_value();
+        if (measured.has_value()){
+            if (state.type.has_value() && state.type.value() != measured.value()){
+                state.changed_at = now;
+            }
+            state.type = measured;
+            state.verified_at = now;
+            state.error.clear();
+        } else {
+            state.error = error;
+        }
+    }
+
+    if (cache == nullptr) return;
+    if (!measured.has_value()){
+        cache->record_failure(server);
+        return;
+    }
+    cache->record_success(server, true, std::nullopt);
+    // refreshed on every verification, so the ttl runs from the last one
+    if (public_address.has_value()){
+        cache->record_nat(bind_address, gateway, public_address->net_address, measured->mapping_type, measured->filtering_type,
+            static_cast<uint8_t>(measured->hairpin), static_cast<uint8_t>(measured->fragments));
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "binding_manager.h"
+#include "nat_test.h"
+#include "server_cache.h"
+
+struct monitor_params
+{
+    // kept open to notice a mapping change, one is enough; more tell a
+    // single binding's loss from a new public address
+    size_t bindings = 2;
+    keepalive_params keepalive{};
+    // between re-checks of the known type
+    std::chrono::seconds verify_interval{300};
+    // a cached type older than this is tested in full
+    std::chrono::seconds cache_ttl{std::chrono::hours{24}};
+    // verification probes, a few seconds at worst
+    retransmit_params verify_schedule{3, 4, std::chrono::milliseconds{250}, std::chrono::milliseconds{250}, std::chrono::milliseconds{250}};
+};
+
+struct monitor_state
+{
+    net::ipv4 server;
+    // the first kept binding's mapped address, empty until it answers
+    std::optional<net::ipv4> public_address;
+    std::optional<nat_type> type;
+    size_t bindings;
+    size_t mapped;
+    uint64_t mapping_changes;
+    uint64_t verifications;
+    // full tests, the first one included unless the cache had the type
+    uint64_t retests;
+    // seconds since epoch, 0 if never
+    int64_t verified_at;
+    int64_t changed_at;
+    // the last failure, empty after a success
+    std::string error;
+};
+
+// mapping=EIM filtering=APDF hairpinning=unknown fragments=passed
+std::string describe(const nat_type& type);
+// key=value lines, one per field
+std::string format_state(const monitor_state& state);
+// replaces path in one rename, readers never see half a state
+std::expected<void, std::string> write_state(const std::string& path, const monitor_state& state);
+// $XDG_RUNTIME_DIR/stun-client.state
+std::optional<std::string> default_state_path();
+
+// Keeps a few bindings to one server open and watches the NAT behind them.
+// A mapping change shows up at the binding's next refresh, i.e. within one
+// keepalive interval, and triggers a verification right away; otherwise the
+// known type is verified every verify_interval. Verifying costs a handful
+// of requests, only a type that no longer holds is tested in full; that is
+// also where hairpinning and fragment handling are measured again. Results
+// go to the cache, if there is one, and every change to the state handler.
+class nat_monitor{
+public:
+    // called from the monitor thread
+    using state_handler = std::function<void(const monitor_state&)>;
+
+private:
+    net::ipv4 server;
+    uint32_t bind_address;
+    // used from the monitor thread only
+    server_cache* cache;
+    monitor_params params;
+    state_handler on_state;
+
+    std::mutex m;
+    std::condition_variable_any cv;
+    monitor_state state;
+    // a binding's mapped address changed since the worker last looked
+    bool moved;
+
+    // the verification sockets come and go on it
+    net::reactor reactor;
+    // its change handler uses the members above, so it is destroyed first
+    binding_manager manager;
+    std::jthread worker;
+
+    void run(std::stop_token st);
+    void verify();
+    void publish();
+
+public:
+    // cache may be null
+    explicit nat_monitor(net::ipv4 server, uint32_t bind_address, server_cache* cache, monitor_params params = {});
+    nat_monitor(const nat_monitor&) = delete;
+    nat_monitor& operator=(const nat_monitor&) = delete;
+    ~nat_monitor();
+
+    // set before start()
+    inline void set_on_state(state_handler handler){ on_state = std::move(handler); }
+
+    // opens the bindings and starts watching, the first verification runs
+    // right away
+    std::expected<void, std::string> start();
+
+    monitor_state snapshot();
+};
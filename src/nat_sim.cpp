@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <format>
+#include <list>
+#include "nat_sim.h"
+#include "port_prediction.h"
+#include "discovery.h"
+#include "log.h"
+
+namespace sim {
+
+    constexpr uint32_t client_address = math::hton<uint32_t>(0xC0A80102);      // 192.168.1.2
+    constexpr uint32_t nat_public_address = math::hton<uint32_t>(0xCB007101);  // 203.0.113.1
+    constexpr uint32_t server_primary_address = math::hton<uint32_t>(0xC6336401);   // 198.51.100.1
+    constexpr uint32_t server_alternate_address = math::hton<uint32_t>(0xC6336402); // 198.51.100.2
+    constexpr uint16_t server_primary_port = math::hton<uint16_t>(3478);
+    constexpr uint16_t server_alternate_port = math::hton<uint16_t>(3479);
+    // ethernet, less the IP and UDP headers
+    constexpr size_t max_unfragmented = 1500 - 20 - 8;
+
+    // an ephemeral port, host byte order, with the next count ones in range too
+    uint16_t ephemeral_base(uint16_t count){
+        return math::random<uint16_t>(32768, 65535 - count);
+    }
+
+    client_sim::client_sim(network& nw, uint32_t net_ip, uint16_t net_port, std::shared_ptr<txn_manager> shared)
+        : client{std::move(shared)}, nw{nw}, self_addr{net_ip, net_port} {
+        nw.hosts[self_addr] = this;
+    }
+
+    client_sim::~client_sim(){
+        nw.hosts.erase(self_addr);
+    }
+
+    // same schedule as client_udpv4::request, but waiting is just moving the clock
+    client_sim::request_task client_sim::request(const net::ipv4& ip, const stun::message& msg, transmissions<clock_t>& tx){
+        auto& params = tx.params;
+        for (uint32_t i = 0; i < params.Rc; i++){
+            nw.last_delivered.reset();
+            auto sent_at = nw.time();
+            tx.sent();
+            nw.send(self_addr, ip, msg);
+            if (nw.last_delivered == msg.get_txn_id()){
+                return {};
+            }
+            auto interval = params.interval(tx.rto, i);
+            if (auto waited = nw.time() - sent_at; waited < interval){
+                nw.advance(interval - waited);
+            }
+        }
+
+        tx.exhausted.store(true);
+        this->onTimeout(msg.get_txn_id());
+        return {};
+    }
+
+
+    nat::nat(const nat_config& cfg, uint32_t public_address, std::mt19937_64& rng)
+        : cfg{cfg}, public_address{public_address}, next_port{1024}, rng{rng} {}
+
+    net::ipv4 nat::remote_key(const net::ipv4& remote) const {
+        switch (cfg.mapping_type){
+            case address_dependent_mapping:
+                return net::ipv4{remote.net_address, 0};
+            case address_and_port_dependent_mapping:
+                return remote;
+            default:
+                return net::ipv4{};
+        }
+    }
+
+    bool nat::expired(const binding& b, clock_t::time_point now) const {
+        return now - b.last_active > cfg.binding_lifetime;
+    }
+
+    uint16_t nat::allocate_port(const net::ipv4& internal){
+        auto in_use = [&](uint16_t net_port){
+            return bindings.contains(net::ipv4{public_address, net_port});
+        };
+
+        if (cfg.allocation == port_allocation::preserve && !in_use(internal.net_port)){
+            return internal.net_port;
+        }
+        if (cfg.allocation == port_allocation::random){
+            std::uniform_int_distribution<uint16_t> dist(1024, 65535);
+            uint16_t net_port;
+            do {
+                net_port = math::hton<uint16_t>(dist(rng));
+            } while (in_use(net_port));
+            return net_port;
+        }
+
+        uint16_t net_port;
+        do {
+            net_port = math::hton<uint16_t>(next_port);
+            next_port = next_port == 65535 ? 1024 : next_port + 1;
+        } while (in_use(net_port));
+        return net_port;
+    }
+
+    net::ipv4 nat::outbound(const net::ipv4& internal, const net::ipv4& remote, clock_t::time_point now){
+        auto key = std::make_tuple(internal, remote_key(remote));
+
+        if (auto it = mappings.find(key); it != mappings.end()){
+            auto b = bindings.find(it->second);
+            if (!expired(b->second, now)){
+                b->second.last_active = now;
+                b->second.permitted.insert(remote);
+                return it->second;
+            }
+            seele::log::sync().info("binding {} expired\n", it->second.toString());
+            bindings.erase(b);
+            mappings.erase(it);
+        }
+
+        net::ipv4 external = cfg.mapping_type == no_nat_mapping ?
+            internal : net::ipv4{public_address, allocate_port(internal)};
+
+        mappings.emplace(key, external);
+        bindings.emplace(external, binding{internal, {remote}, now});
+        return external;
+    }
+
+    std::optional<net::ipv4> nat::inbound(const net::ipv4& remote, const net::ipv4& external, clock_t::time_point now){
+        auto it = bindings.find(external);
+        if (it == bindings.end() || expired(it->second, now)){
+            return std::nullopt;
+        }
+
+        auto& permitted = it->second.permitted;
+        switch (cfg.filtering_type){
+            case address_dependent_filtering:
+                if (std::ranges::none_of(permitted, [&](const net::ipv4& p){ return p.net_address == remote.net_address; })){
+                    return std::nullopt;
+                }
+                break;
+            case address_and_port_dependent_filtering:
+                if (!permitted.contains(remote)){
+                    return std::nullopt;
+                }
+                break;
+            default:
+                break;
+        }
+        return it->second.internal;
+    }
+
+    std::optional<net::ipv4> nat::hairpin(const net::ipv4& external, clock_t::time_point now){
+        auto it = bindings.find(external);
+        if (it == bindings.end() || expired(it->second, now)){
+            return std::nullopt;
+        }
+        return it->second.internal;
+    }
+
+
+    bool stun_server::serves(const net::ipv4& addr) const {
+        return (addr.net_address == primary.net_address || addr.net_address == alternate.net_address) &&
+               (addr.net_port == primary.net_port || addr.net_port == alternate.net_port);
+    }
+
+    void stun_server::handle(network& net, const net::ipv4& src, const net::ipv4& dst, const stun::message& msg) const {
+        // parse from the wire bytes, like a real server would
+        stun::message req{msg.data_ptr()};
+        if (req.get_type() != (stun::msg_method::BINDING | stun::msg_type::REQUEST)){
+            return;
+        }
+
+        auto [change, response_port, padding] = req.find<stun::changeRequest, stun::responsePort, stun::padding>();
+
+        net::ipv4 origin = dst;
+        if (change != nullptr){
+            if (change->flags & stun::CHANGE_IP_FLAG){
+                origin.net_address = origin.net_address == primary.net_address ? alternate.net_address : primary.net_address;
+            }
+            if (change->flags & stun::CHANGE_PORT_FLAG){
+                origin.net_port = origin.net_port == primary.net_port ? alternate.net_port : primary.net_port;
+            }
+        }
+
+        net::ipv4 target = src;
+        if (response_port != nullptr){
+            target.net_port = response_port->port;
+        }
+
+        stun::message res(stun::msg_method::BINDING | stun::msg_type::SUCCESS_RESPONSE,
+            padding != nullptr ? stun::max_message_size : stun::default_message_size);
+        res.set_txn_id(req.get_txn_id());
+        res.emplace<stun::ipv4_xor_mappedAddress>(src.net_address, src.net_port);
+        res.emplace<stun::ipv4_responseOrigin>(origin.net_address, origin.net_port);
+        res.emplace<stun::ipv4_otherAddress>(alternate.net_address, alternate.net_port);
+        // the answer is padded as much, so it comes back fragmented too
+        if (padding != nullptr){
+            res.pad(math::ntoh(padding->length));
+        }
+
+        net.reply(origin, target, res);
+    }
+
+
+    network::network(const nat_config& cfg)
+        : cfg{cfg}, rng{cfg.seed},
+          gateway{this->cfg, nat_public_address, rng},
+          server{
+              net::ipv4{server_primary_address, server_primary_port},
+              net::ipv4{server_alternate_address, server_alternate_port}
+          } {}
+
+    bool network::lost(){
+        if (cfg.loss <= 0.0) return false;
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < cfg.loss;
+    }
+
+    bool network::dropped_fragments(const stun::message& msg) const {
+        return !cfg.fragments && msg.size() > max_unfragmented;
+    }
+
+    void network::send(const net::ipv4& src, const net::ipv4& dst, const stun::message& msg){
+        auto external = gateway.outbound(src, dst, time());
+        advance(cfg.one_way_delay);
+        if (lost() || dropped_fragments(msg)) return;
+
+        if (gateway.owns(dst)){
+            if (!cfg.hairpinning) return;
+            auto internal = gateway.hairpin(dst, time());
+            if (!internal.has_value()) return;
+
+            auto it = hosts.find(internal.value());
+            if (it == hosts.end()) return;
+
+            last_delivered = msg.get_txn_id();
+            it->second->deliver(net::ipv4{external}, stun::message{msg.data_ptr()});
+            return;
+        }
+        if (!server.serves(dst)) return;
+
+        server.handle(*this, external, dst, msg);
+    }
+
+    void network::reply(const net::ipv4& src, const net::ipv4& dst, const stun::message& msg){
+        advance(cfg.one_way_delay);
+        if (lost() || dropped_fragments(msg)) return;
+
+        auto internal = gateway.inbound(src, dst, time());
+        if (!internal.has_value()) return;
+
+        auto it = hosts.find(internal.value());
+        if (it == hosts.end()) return;
+
+        last_delivered = msg.get_txn_id();
+        it->second->deliver(net::ipv4{src}, stun::message{msg.data_ptr()});
+    }
+
+
+    std::string describe(const nat_config& cfg){
+        constexpr std::string_view mappings[] = {"EIM", "ADM", "APDM", "none"};
+        constexpr std::string_view filterings[] = {"EIF", "ADF", "APDF"};
+        constexpr std::string_view allocations[] = {"preserve", "sequential", "random"};
+        return std::format("mapping={} filtering={} allocation={} lifetime={}s hairpinning={} fragments={} seed={}",
+            mappings[cfg.mapping_type >> 2],
+            filterings[cfg.filtering_type],
+            allocations[static_cast<int>(cfg.allocation)],
+            std::chrono::duration_cast<std::chrono::seconds>(cfg.binding_lifetime).count(),
+            cfg.hairpinning, cfg.fragments,
+            cfg.seed
+        );
+    }
+
+    scenario_report run_scenarios(size_t rounds, uint64_t seed){
+        constexpr uint8_t mappings[] = {
+            endpoint_independent_mapping, address_dependent_mapping,
+            address_and_port_dependent_mapping, no_nat_mapping
+        };
+        constexpr uint8_t filterings[] = {
+            endpoint_independent_filtering, address_dependent_filtering,
+            address_and_port_dependent_filtering
+        };
+        constexpr port_allocation allocations[] = {
+            port_allocation::preserve, port_allocation::sequential, port_allocation::random
+        };
+        constexpr std::chrono::seconds lifetimes[] = {30s, 75s, 180s, 420s};
+        constexpr uint64_t acceptable_error = 16;
+        // the last one outlives lifetime_params::limit, the test has to give up
+        constexpr std::chrono::seconds parallel_lifetimes[] = {30s, 180s, 700s, 3h};
+        constexpr size_t parallel_bindings = 8;
+        constexpr size_t port_samples = 128;
+        constexpr std::chrono::seconds discovery_lifetime = 75s;
+        constexpr retransmit_params verify_schedule{3, 4, 250ms, 250ms, 250ms};
+
+        scenario_report report{0, 0, {}, {}};
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t round = 0; round < rounds; round++){
+            for (auto mapping : mappings)
+            for (auto filtering : filterings)
+            for (auto allocation : allocations){
+                nat_config cfg{};
+                cfg.mapping_type = mapping;
+                cfg.filtering_type = filtering;
+                cfg.allocation = allocation;
+                cfg.hairpinning = report.total % 2 == 0;
+                cfg.fragments = report.total % 3 != 0;
+                cfg.seed = seed + report.total;
+
+                network n{cfg};
+                uint16_t port = ephemeral_base(3);
+                client_sim c{n, client_address, math::hton<uint16_t>(port)},
+                           aux{n, client_address, math::hton<uint16_t>(port + 1)};
+                net::ipv4 server_addr = n.get_server().get_primary();
+
+                auto res = nat_test(c, aux, server_addr);
+                report.total++;
+
+                auto hairpin = mapping == no_nat_mapping ? hairpinning::unknown :
+                    cfg.hairpinning ? hairpinning::supported : hairpinning::unsupported;
+                auto fragments = cfg.fragments ? fragment_handling::passed : fragment_handling::dropped;
+
+                if (!res.has_value()){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: {}", describe(cfg), res.error()));
+                } else if (res->mapping_type != mapping || res->filtering_type != filtering){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: classified as mapping={} filtering={}",
+                        describe(cfg), res->mapping_type, res->filtering_type));
+                } else if (res->hairpin != hairpin || res->fragments != fragments){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: hairpinning {} fragments {}",
+                        describe(cfg), static_cast<int>(res->hairpin), static_cast<int>(res->fragments)));
+                }
+
+                // the cheap re-check confirms the emulated type and rejects another one
+                client_sim v{n, client_address, math::hton<uint16_t>(port + 2)},
+                           vaux{n, client_address, math::hton<uint16_t>(port + 3)};
+                nat_type actual{filtering, mapping};
+                nat_type other{filtering == endpoint_independent_filtering ? address_dependent_filtering : endpoint_independent_filtering, mapping};
+                auto same = async_verify_nat_type(v, vaux, server_addr, actual, verify_schedule).get_as_rvalue();
+                auto changed = async_verify_nat_type(v, vaux, server_addr, other, verify_schedule).get_as_rvalue();
+                report.total++;
+                if (!same.has_value() || !changed.has_value() || !same.value() || changed.value()){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: verification {}",
+                        describe(cfg), !same.has_value() ? same.error() : !changed.has_value() ? changed.error() : "disagrees"));
+                }
+            }
+
+            for (auto mapping : mappings)
+            for (auto lifetime : lifetimes){
+                nat_config cfg{};
+                cfg.mapping_type = mapping;
+                cfg.filtering_type = address_and_port_dependent_filtering;
+                cfg.binding_lifetime = lifetime;
+                cfg.seed = seed + report.total;
+
+                network n{cfg};
+                uint16_t port = ephemeral_base(1);
+                // Y's RESPONSE-PORT answers arrive at X
+                client_sim X{n, client_address, math::hton<uint16_t>(port)},
+                           Y{n, client_address, math::hton<uint16_t>(port + 1), X.get_txn_manager()};
+                net::ipv4 server_addr = n.get_server().get_primary();
+
+                auto task = lifetime_test(X, Y, server_addr);
+                auto& timer = coro::timer::timer_impl<clock_t>::get_instance();
+                while (!task.done() && timer.advance_to_next());
+
+                auto& res = task.get();
+                report.total++;
+
+                if (!res.has_value()){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: {}", describe(cfg), res.error()));
+                } else if (res.value() + acceptable_error < static_cast<uint64_t>(lifetime.count()) ||
+                           res.value() > lifetime.count() + acceptable_error){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: measured lifetime {}s", describe(cfg), res.value()));
+                }
+            }
+
+            for (auto mapping : mappings)
+            for (auto lifetime : parallel_lifetimes){
+                nat_config cfg{};
+                cfg.mapping_type = mapping;
+                cfg.filtering_type = address_and_port_dependent_filtering;
+                cfg.binding_lifetime = lifetime;
+                cfg.seed = seed + report.total;
+
+                network n{cfg};
+                uint16_t port = ephemeral_base(parallel_bindings);
+                client_sim Y{n, client_address, math::hton<uint16_t>(port + parallel_bindings)};
+                std::list<client_sim> clients;
+                std::vector<client_sim*> X;
+                for (size_t k = 0; k < parallel_bindings; k++){
+                    X.push_back(&clients.emplace_back(n, client_address, math::hton<uint16_t>(port + k), Y.get_txn_manager()));
+                }
+                net::ipv4 server_addr = n.get_server().get_primary();
+
+                auto task = parallel_lifetime_test<client_sim>(X, Y, server_addr, lifetime_params{});
+                auto& timer = coro::timer::timer_impl<clock_t>::get_instance();
+                while (!task.done() && timer.advance_to_next());
+
+                auto& res = task.get();
+                report.total++;
+
+                bool outlives = lifetime > lifetime_params{}.limit;
+                if (!res.has_value()){
+                    if (!outlives){
+                        report.mismatched++;
+                        report.failures.emplace_back(std::format("{}: {}", describe(cfg), res.error()));
+                    }
+                } else if (outlives || res.value() < static_cast<uint64_t>(lifetime.count()) ||
+                           res.value() > lifetime.count() + acceptable_error){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: measured lifetime {}s with {} bindings", describe(cfg), res.value(), parallel_bindings));
+                }
+            }
+
+            // discover_nat end to end, its sockets opened on the emulated network
+            for (auto mapping : mappings){
+                nat_config cfg{};
+                cfg.mapping_type = mapping;
+                cfg.filtering_type = address_and_port_dependent_filtering;
+                cfg.binding_lifetime = discovery_lifetime;
+                cfg.seed = seed + report.total;
+
+                network n{cfg};
+                // primary, aux, Y and the X sockets
+                uint16_t port = ephemeral_base(parallel_bindings + 3);
+                nat_discovery_config<client_sim> dcfg{};
+                dcfg.server = n.get_server().get_primary();
+                dcfg.open = [&n, port](std::shared_ptr<client_sim::txn_manager> shared) mutable {
+                    return std::expected<std::unique_ptr<client_sim>, std::string>{
+                        std::make_unique<client_sim>(n, client_address, math::hton<uint16_t>(port++), std::move(shared))};
+                };
+                dcfg.lifetime = true;
+                dcfg.lifetime_bindings = parallel_bindings;
+
+                auto task = discover_nat(std::move(dcfg));
+                auto& timer = coro::timer::timer_impl<clock_t>::get_instance();
+                while (!task.done() && timer.advance_to_next());
+
+                auto& res = task.get();
+                report.total++;
+
+                bool mapped = mapping == no_nat_mapping ? res.has_value() && res->mapped == res->local
+                                                        : res.has_value() && n.get_nat().owns(res->mapped);
+                if (!res.has_value()){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: {}", describe(cfg), res.error()));
+                } else if (!mapped || !res->type.has_value() || res->type->mapping_type != mapping ||
+                           res->type->filtering_type != cfg.filtering_type || !res->lifetime.has_value() ||
+                           res->lifetime.value() < static_cast<uint64_t>(discovery_lifetime.count()) ||
+                           res->lifetime.value() > discovery_lifetime.count() + acceptable_error){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: discovered mapped {} mapping={} filtering={} lifetime={}s",
+                        describe(cfg), res->mapped.toString(),
+                        res->type.has_value() ? res->type->mapping_type : 0, res->type.has_value() ? res->type->filtering_type : 0,
+                        res->lifetime.value_or(0)));
+                }
+            }
+
+            // port prediction, then one more mapping to check it against
+            for (auto mapping : mappings)
+            for (auto allocation : allocations){
+                if (mapping == no_nat_mapping) continue;
+                nat_config cfg{};
+                cfg.mapping_type = mapping;
+                cfg.allocation = allocation;
+                cfg.seed = seed + report.total;
+
+                network n{cfg};
+                auto txns = std::make_shared<client_sim::txn_manager>();
+                std::list<client_sim> clients;
+                std::vector<client_sim*> sockets;
+                std::set<uint16_t> used;
+                while (clients.size() <= port_samples){
+                    uint16_t port = net::random_pri_iana_net_port();
+                    if (!used.insert(port).second) continue;
+                    sockets.push_back(&clients.emplace_back(n, client_address, port, txns));
+                }
+                client_sim* next = sockets.back();
+                sockets.pop_back();
+                net::ipv4 server_addr = n.get_server().get_primary();
+
+                auto samples = sample_ports<client_sim>(sockets, server_addr).get_as_rvalue();
+                auto mapped = build_binding(*next, server_addr);
+                report.total++;
+
+                if (!samples.has_value() || !mapped.has_value()){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: {}", describe(cfg), samples.has_value() ? mapped.error() : samples.error()));
+                    continue;
+                }
+
+                auto p = predict_ports(samples.value());
+                constexpr allocation_pattern expected[] = {
+                    allocation_pattern::preserving, allocation_pattern::sequential, allocation_pattern::random
+                };
+                uint16_t port = math::ntoh(mapped->net_port);
+                bool hit = p.pattern == allocation_pattern::preserving
+                    ? mapped->net_port == next->get_self_addr().net_port
+                    : p.pattern == allocation_pattern::random || (port >= p.first && port <= p.last);
+                if (p.pattern != expected[static_cast<int>(allocation)] || !hit){
+                    report.mismatched++;
+                    report.failures.emplace_back(std::format("{}: predicted {}, next mapping {}", describe(cfg), describe(p), port));
+                }
+            }
+        }
+
+        report.elapsed = std::chrono::steady_clock::now() - start;
+        return report;
+    }
+}
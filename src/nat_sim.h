@@ -0,0 +1,172 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include <optional>
+
+#include "client.h"
+#include "nat_test.h"
+#include "stun.h"
+#include "coro/timer.h"
+
+// In-process NAT emulator. Every hop is delivered synchronously and time is
+// coro::timer::virtual_clock, so a whole classification runs on the calling
+// thread without sockets or sleeps; timer awaiters are fired by advancing
+// timer_impl<virtual_clock>.
+namespace sim {
+    using namespace std::chrono_literals;
+    using clock_t = coro::timer::virtual_clock;
+
+    enum class port_allocation {
+        preserve,
+        sequential,
+        random
+    };
+
+    struct nat_config{
+        uint8_t mapping_type = endpoint_independent_mapping;
+        uint8_t filtering_type = endpoint_independent_filtering;
+        std::chrono::milliseconds binding_lifetime = 120s;
+        port_allocation allocation = port_allocation::preserve;
+        std::chrono::milliseconds one_way_delay = 10ms;
+        double loss = 0.0;
+        // packets from inside to the NAT's own address come back in
+        bool hairpinning = false;
+        // datagrams past the MTU, i.e. IP fragments, get through
+        bool fragments = true;
+        uint64_t seed = 0;
+    };
+
+    class network;
+
+    class client_sim : public client<client_sim, net::ipv4>{
+    private:
+        friend class client<client_sim, net::ipv4>;
+        friend class network;
+
+        // the request finishes before request() returns, nothing to cancel
+        struct request_task{
+            inline bool cancel(){ return true; }
+            inline std::suspend_never operator co_await() const noexcept { return {}; }
+        };
+
+        network& nw;
+        net::ipv4 self_addr;
+
+        request_task request(const net::ipv4& ip, const stun::message& msg, transmissions<clock_t>& tx);
+
+        inline void deliver(net::ipv4&& ip, stun::message&& msg){
+            this->onResponse(std::move(ip), std::move(msg));
+        }
+
+    public:
+        using clock_t = sim::clock_t;
+
+        explicit client_sim(network& nw, uint32_t net_ip, uint16_t net_port, std::shared_ptr<txn_manager> shared = nullptr);
+        client_sim(const client_sim&) = delete;
+        client_sim& operator=(const client_sim&) = delete;
+        ~client_sim();
+
+        inline const net::ipv4& get_self_addr() const { return self_addr; }
+    };
+
+    class nat{
+    private:
+        struct binding{
+            net::ipv4 internal;
+            std::set<net::ipv4> permitted;
+            clock_t::time_point last_active;
+        };
+
+        const nat_config& cfg;
+        uint32_t public_address;
+        uint16_t next_port;
+        std::mt19937_64& rng;
+
+        // (internal endpoint, remote key) -> external endpoint
+        std::map<std::tuple<net::ipv4, net::ipv4>, net::ipv4> mappings;
+        std::map<net::ipv4, binding> bindings;
+
+        net::ipv4 remote_key(const net::ipv4& remote) const;
+        bool expired(const binding& b, clock_t::time_point now) const;
+        uint16_t allocate_port(const net::ipv4& internal);
+
+    public:
+        explicit nat(const nat_config& cfg, uint32_t public_address, std::mt19937_64& rng);
+
+        net::ipv4 outbound(const net::ipv4& internal, const net::ipv4& remote, clock_t::time_point now);
+        std::optional<net::ipv4> inbound(const net::ipv4& remote, const net::ipv4& external, clock_t::time_point now);
+        // the internal endpoint behind external, filtering does not apply
+        std::optional<net::ipv4> hairpin(const net::ipv4& external, clock_t::time_point now);
+
+        inline bool owns(const net::ipv4& addr) const { return addr.net_address == public_address; }
+
+        inline size_t binding_count() const { return bindings.size(); }
+    };
+
+    // RFC 5780 server listening on primary/alternate address and port pairs
+    class stun_server{
+    private:
+        net::ipv4 primary;
+        net::ipv4 alternate;
+
+    public:
+        explicit stun_server(net::ipv4 primary, net::ipv4 alternate) : primary{primary}, alternate{alternate} {}
+
+        bool serves(const net::ipv4& addr) const;
+        void handle(network& net, const net::ipv4& src, const net::ipv4& dst, const stun::message& msg) const;
+
+        inline const net::ipv4& get_primary() const { return primary; }
+        inline const net::ipv4& get_alternate() const { return alternate; }
+    };
+
+    class network{
+    private:
+        friend class client_sim;
+
+        nat_config cfg;
+        std::mt19937_64 rng;
+        nat gateway;
+        stun_server server;
+        std::map<net::ipv4, client_sim*> hosts;
+        std::optional<stun::txn_id_t> last_delivered;
+
+        bool lost();
+        bool dropped_fragments(const stun::message& msg) const;
+
+    public:
+        explicit network(const nat_config& cfg);
+        network(const network&) = delete;
+        network& operator=(const network&) = delete;
+
+        // host -> NAT -> server, or back to a host when hairpinning
+        void send(const net::ipv4& src, const net::ipv4& dst, const stun::message& msg);
+        // server -> NAT -> host
+        void reply(const net::ipv4& src, const net::ipv4& dst, const stun::message& msg);
+
+        inline void advance(clock_t::duration d) { clock_t::advance(d); }
+        inline clock_t::time_point time() const { return clock_t::now(); }
+
+        inline const stun_server& get_server() const { return server; }
+        inline const nat& get_nat() const { return gateway; }
+    };
+
+    struct scenario_report{
+        size_t total;
+        size_t mismatched;
+        std::chrono::nanoseconds elapsed;
+        std::vector<std::string> failures;
+    };
+
+    // runs nat_test against every mapping x filtering x allocation combination,
+    // then lifetime_test and parallel_lifetime_test against a range of binding lifetimes,
+    // then discover_nat against every mapping, then predict_ports against every
+    // mapping x allocation
+    scenario_report run_scenarios(size_t rounds, uint64_t seed);
+
+    std::string describe(const nat_config& cfg);
+}
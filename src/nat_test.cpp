@@ -1,97 +1,199 @@
+#include <algorithm>
 #include <cstdint>
 #include <expected>
+#include <list>
+#include <vector>
 
 #include "nat_test.h"
 #include "log.h"
 #include "net/udpv4.h"
 #include "stun.h"
-std::expected<uint8_t, std::string> maping_test(clientImpl& c, net::ipv4& server_addr, net::ipv4& server_altaddr, net::ipv4& first_x_maddr){
-
-    stun::message ipmaping_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
-    
-    auto res = c.async_req(
-        net::ipv4{
-            server_altaddr.net_address,
-            server_addr.net_port
-        }, ipmaping_test_msg)
-        .get_as_rvalue();
-    
+#include "nat_sim.h"
+template <typename client_t>
+std::expected<net::ipv4, std::string> mapped_address(typename client_t::req_task& probe){
+    auto res = probe.get_as_rvalue();
     if (!res.has_value()){
         return std::unexpected(res.error());
     }
 
-
-
-    auto x_addr = std::get<1>(res.value()).find_one<stun::ipv4_xor_mappedAddress>();
+    auto x_addr = std::get<1>(res.value()).template find_one<stun::ipv4_xor_mappedAddress>();
     if (x_addr == nullptr){
         return std::unexpected("server has undefined behavior");
     }
 
-    net::ipv4 second_x_maddr{
+    return net::ipv4{
         x_addr->get_net_address(), 
         x_addr->get_net_port()
     };
+}
 
-    if (first_x_maddr == second_x_maddr){
-        return endpoint_independent_mapping;
-    }
+inline stun::message change_request_msg(uint32_t flags){
+    stun::message msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+    msg.emplace<stun::changeRequest>(flags);
+    return msg;
+}
 
+// Both probes are in flight as soon as this is constructed; result() only
+// collects the answers. The messages must outlive the probes.
+template <typename client_t>
+class maping_test{
+private:
+    typename client_t::req_task& first_probe;
+    // the alternate address with the primary port; async_req keeps a reference
+    net::ipv4 ipmaping_target;
+    stun::message ipmaping_test_msg;
+    stun::message portmaping_test_msg;
+    typename client_t::req_task ipmaping_probe;
+    typename client_t::req_task portmaping_probe;
+
+public:
+    maping_test(client_t& c, net::ipv4& server_addr, net::ipv4& server_altaddr, typename client_t::req_task& first_probe,
+                std::optional<retransmit_params> schedule = std::nullopt) :
+        first_probe{first_probe},
+        ipmaping_target{server_altaddr.net_address, server_addr.net_port},
+        ipmaping_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST),
+        portmaping_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST),
+        ipmaping_probe{c.async_req(this->ipmaping_target, ipmaping_test_msg, schedule)},
+        portmaping_probe{c.async_req(server_altaddr, portmaping_test_msg, schedule)} {}
+
+    coro::lazy_task<std::expected<uint8_t, std::string>> result(){
+        co_await first_probe;
+        auto first_x_maddr = mapped_address<client_t>(first_probe);
+        if (!first_x_maddr.has_value()){
+            co_return std::unexpected(first_x_maddr.error());
+        }
 
-    stun::message portmaping_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
-    auto res2 = c.async_req(server_altaddr, portmaping_test_msg)
-        .get_as_rvalue();
+        co_await ipmaping_probe;
+        auto second_x_maddr = mapped_address<client_t>(ipmaping_probe);
+        if (!second_x_maddr.has_value()){
+            co_return std::unexpected(second_x_maddr.error());
+        }
 
-    if (!res2.has_value()){
-        return std::unexpected(res2.error());
-    }
+        if (first_x_maddr.value() == second_x_maddr.value()){
+            co_return endpoint_independent_mapping;
+        }
 
-    auto x_addr2 = std::get<1>(res2.value()).find_one<stun::ipv4_xor_mappedAddress>();
-    if (x_addr2 == nullptr){
-        return std::unexpected("server has undefined behavior");
+        co_await portmaping_probe;
+        auto third_x_maddr = mapped_address<client_t>(portmaping_probe);
+        if (!third_x_maddr.has_value()){
+            co_return std::unexpected(third_x_maddr.error());
+        }
+
+        co_return second_x_maddr.value() == third_x_maddr.value() ? address_dependent_mapping : address_and_port_dependent_mapping;
     }
+};
+
+// For probes whose silence is the answer: filtering behind a filtering NAT,
+// hairpinning and fragments on most NATs. The default schedule would spend
+// up to ~40s confirming each no; this gives up after 1.75s, and the basic
+// Binding request has already shown that the server answers.
+constexpr retransmit_params silence_schedule{3, 4, std::chrono::milliseconds{250}, std::chrono::milliseconds{250}, std::chrono::milliseconds{250}};
+
+template <typename client_t>
+class filtering_test{
+private:
+    stun::message ipfiltering_test_msg;
+    stun::message portfiltering_test_msg;
+    typename client_t::req_task ipfiltering_probe;
+    typename client_t::req_task portfiltering_probe;
+
+public:
+    filtering_test(client_t& c, net::ipv4& server_addr, retransmit_params schedule = silence_schedule) :
+        ipfiltering_test_msg{change_request_msg(stun::CHANGE_IP_FLAG | stun::CHANGE_PORT_FLAG)},
+        portfiltering_test_msg{change_request_msg(stun::CHANGE_PORT_FLAG)},
+        ipfiltering_probe{c.async_req(server_addr, ipfiltering_test_msg, schedule)},
+        portfiltering_probe{c.async_req(server_addr, portfiltering_test_msg, schedule)} {}
+
+    coro::lazy_task<uint8_t> result(){
+        auto& ip_res = co_await ipfiltering_probe;
+        if (ip_res.has_value()){
+            co_return endpoint_independent_filtering;
+        }
 
-    net::ipv4 third_x_maddr{
-        x_addr2->get_net_address(),
-        x_addr2->get_net_port()
-    };
+        auto& port_res = co_await portfiltering_probe;
+        co_return port_res.has_value() ? 
+            address_dependent_filtering : address_and_port_dependent_filtering;
+    }
+};
+
+// A Binding request to our own mapped address. A NAT that hairpins hands it
+// back to c, where it completes its own transaction.
+template <typename client_t>
+class hairpin_test{
+private:
+    net::ipv4 mapped_addr;
+    stun::message hairpin_test_msg;
+    typename client_t::req_task hairpin_probe;
+
+public:
+    hairpin_test(client_t& c, const net::ipv4& mapped_addr) :
+        mapped_addr{mapped_addr},
+        hairpin_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST),
+        hairpin_probe{c.async_req(this->mapped_addr, hairpin_test_msg, silence_schedule)} {}
+
+    coro::lazy_task<hairpinning> result(){
+        auto& res = co_await hairpin_probe;
+        co_return res.has_value() ? hairpinning::supported : hairpinning::unsupported;
+    }
+};
 
-    return first_x_maddr == third_x_maddr ? address_dependent_mapping : address_and_port_dependent_mapping;
+// RFC 5780 7.6: padded to the MTU of an ethernet link, so that with the IP
+// and UDP headers the request leaves in fragments
+constexpr uint16_t fragment_padding = 1500;
 
+inline stun::message padded_msg(){
+    stun::message msg(stun::msg_method::BINDING | stun::msg_type::REQUEST, stun::max_message_size);
+    msg.pad(fragment_padding);
+    return msg;
 }
 
-uint8_t filtering_test(clientImpl& c, net::ipv4& server_addr){
+template <typename client_t>
+class fragment_test{
+private:
+    stun::message fragment_test_msg;
+    typename client_t::req_task fragment_probe;
 
-    stun::message ipfiltering_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
-    
-    ipfiltering_test_msg.emplace<stun::changeRequest>(stun::CHANGE_IP_FLAG | stun::CHANGE_PORT_FLAG);
-
-    if(c.async_req(server_addr, ipfiltering_test_msg)
-        .get()
-        .has_value()){
-        return endpoint_independent_filtering;
-    }
+public:
+    fragment_test(client_t& c, net::ipv4& server_addr) :
+        fragment_test_msg{padded_msg()},
+        fragment_probe{c.async_req(server_addr, fragment_test_msg, silence_schedule)} {}
 
-    stun::message portfiltering_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
-    portfiltering_test_msg.emplace<stun::changeRequest>(stun::CHANGE_PORT_FLAG);
+    // only meaningful once an unpadded request got through
+    coro::lazy_task<fragment_handling> result(){
+        auto& res = co_await fragment_probe;
+        if (!res.has_value()){
+            co_return fragment_handling::dropped;
+        }
 
-    return c.async_req(server_addr, portfiltering_test_msg)
-        .get()
-        .has_value() ? 
-        address_dependent_filtering : address_and_port_dependent_filtering;
-}
+        // e.g. 420, the server does not know PADDING
+        auto& response = std::get<1>(res.value());
+        if (response.get_type() != (stun::msg_method::BINDING | stun::msg_type::SUCCESS_RESPONSE)){
+            co_return fragment_handling::unknown;
+        }
+        co_return response.template find_one<stun::padding>() != nullptr ?
+            fragment_handling::passed : fragment_handling::outbound;
+    }
+};
 
-std::expected<nat_type, std::string> nat_test(clientImpl &c, net::ipv4 server_addr){
+template <typename client_t>
+coro::lazy_task<std::expected<nat_type, std::string>> async_nat_test(client_t &c, client_t &aux, net::ipv4 server_addr){
 
     stun::message udp_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+    stun::message aux_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
 
-    auto res = c.async_req(server_addr, udp_test_msg)
-                    .get_as_rvalue();
+    // mapping test I runs on aux alongside the basic binding, it does not need OTHER-ADDRESS
+    // the fragment test needs nothing from the first answer either
+    fragment_test<client_t> fragments{c, server_addr};
+    auto basic_probe = c.async_req(server_addr, udp_test_msg);
+    auto aux_probe = aux.async_req(server_addr, aux_test_msg);
 
-    if (!res.has_value()) return std::unexpected(res.error());
+    auto res = co_await std::move(basic_probe);
+
+    if (!res.has_value()) co_return std::unexpected(res.error());
 
     auto& [ipinfo, responce_msg] = res.value();    
-    auto [x_addr, otheraddr] = responce_msg.find<stun::ipv4_xor_mappedAddress, stun::ipv4_otherAddress>();
-    if (otheraddr == nullptr || x_addr == nullptr) return std::unexpected("server does not support stun-behavior");
+    auto [x_addr, otheraddr] = responce_msg.template find<stun::ipv4_xor_mappedAddress, stun::ipv4_otherAddress>();
+    if (otheraddr == nullptr || x_addr == nullptr) co_return std::unexpected("server does not support stun-behavior");
 
     net::ipv4 first_x_maddr{
         x_addr->get_net_address(),
@@ -102,26 +204,37 @@ std::expected<nat_type, std::string> nat_test(clientImpl &c, net::ipv4 server_ad
     };
 
     if (server_addr.net_address == server_altaddr.net_address || 
-        server_addr.net_port == server_altaddr.net_port) return std::unexpected("server has undefined behavior");
+        server_addr.net_port == server_altaddr.net_port) co_return std::unexpected("server has undefined behavior");
 
     if (first_x_maddr == c.get_self_addr()){
-        return nat_type{
-            filtering_test(c, server_addr),
-            no_nat_mapping
+        // without a NAT there is nothing to hairpin through
+        filtering_test<client_t> filtering{c, server_addr};
+        co_return nat_type{
+            co_await filtering.result(),
+            no_nat_mapping,
+            hairpinning::unknown,
+            co_await fragments.result()
         };
 
     } else {
-        auto filtering = filtering_test(c, server_addr);
-        auto res = maping_test(c, server_addr, server_altaddr, first_x_maddr);
+        // mapping probes go out on aux, so contacting the alternate address
+        // does not open the filter that the CHANGE-REQUEST probes on c rely on
+        maping_test<client_t> maping{aux, server_addr, server_altaddr, aux_probe};
+        hairpin_test<client_t> hairpin{c, first_x_maddr};
+        filtering_test<client_t> filtering{c, server_addr};
+
+        auto res = co_await maping.result();
         if (!res.has_value()){
-            return std::unexpected(res.error());
+            co_return std::unexpected(res.error());
         }
 
         auto mapping = res.value();
         
-        return nat_type{
-            filtering,
-            mapping
+        co_return nat_type{
+            co_await filtering.result(),
+            mapping,
+            co_await hairpin.result(),
+            co_await fragments.result()
         };
     }
 
@@ -129,26 +242,74 @@ std::expected<nat_type, std::string> nat_test(clientImpl &c, net::ipv4 server_ad
 
 }
 
-std::expected<net::ipv4, std::string> build_binding(clientImpl& c, net::ipv4& server_addr){
+template <typename client_t>
+std::expected<nat_type, std::string> nat_test(client_t &c, client_t &aux, net::ipv4 server_addr){
+    return async_nat_test(c, aux, server_addr).get_as_rvalue();
+}
+
+template <typename client_t>
+coro::lazy_task<std::expected<bool, std::string>> async_verify_nat_type(client_t &c, client_t &aux, net::ipv4 server_addr, nat_type known, retransmit_params schedule){
+    stun::message udp_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+    stun::message aux_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+    auto basic_probe = c.async_req(server_addr, udp_test_msg, schedule);
+    auto aux_probe = aux.async_req(server_addr, aux_test_msg, schedule);
+
+    auto res = co_await std::move(basic_probe);
+    if (!res.has_value()) co_return std::unexpected(res.error());
+
+    auto [x_addr, otheraddr] = std::get<1>(res.value()).template find<stun::ipv4_xor_mappedAddress, stun::ipv4_otherAddress>();
+    if (otheraddr == nullptr || x_addr == nullptr) co_return std::unexpected("server does not support stun-behavior");
+
+    net::ipv4 server_altaddr{otheraddr->address, otheraddr->port};
+    bool behind_nat = net::ipv4{x_addr->get_net_address(), x_addr->get_net_port()} != c.get_self_addr();
+    if (behind_nat != (known.mapping_type != no_nat_mapping)){
+        co_await aux_probe;
+        co_return false;
+    }
+
+    filtering_test<client_t> filtering{c, server_addr, schedule};
+    if (!behind_nat){
+        co_await aux_probe;
+        co_return co_await filtering.result() == known.filtering_type;
+    }
+
+    maping_test<client_t> maping{aux, server_addr, server_altaddr, aux_probe, schedule};
+    auto mapping = co_await maping.result();
+    if (!mapping.has_value()) co_return std::unexpected(mapping.error());
+
+    auto filtering_type = co_await filtering.result();
+    co_return mapping.value() == known.mapping_type && filtering_type == known.filtering_type;
+}
+
+template <typename client_t>
+coro::lazy_task<std::expected<net::ipv4, std::string>> async_build_binding(client_t& c, net::ipv4 server_addr){
     stun::message ip_test_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
-    auto res = c.async_req(server_addr, ip_test_msg)
-                    .get_as_rvalue();
+    auto res = co_await c.async_req(server_addr, ip_test_msg);
 
-    if (!res.has_value()) return std::unexpected(res.error());
+    if (!res.has_value()) co_return std::unexpected(res.error());
 
     auto& [ipinfo, responce_msg] = res.value();    
-    auto x_addr = responce_msg.find_one<stun::ipv4_xor_mappedAddress>();
-    if (x_addr == nullptr) return std::unexpected("server does not support stun-behavior");
+    auto x_addr = responce_msg.template find_one<stun::ipv4_xor_mappedAddress>();
+    if (x_addr == nullptr) co_return std::unexpected("server does not support stun-behavior");
 
-    return net::ipv4{
+    co_return net::ipv4{
         x_addr->get_net_address(), 
         x_addr->get_net_port()
     };
 }
 
-std::expected<uint64_t, std::string> lifetime_test(clientImpl& X, clientImpl& Y, net::ipv4& server_addr) {
+template <typename client_t>
+std::expected<net::ipv4, std::string> build_binding(client_t& c, net::ipv4& server_addr){
+    return async_build_binding(c, server_addr).get_as_rvalue();
+}
+
+template <typename client_t>
+coro::lazy_task<std::expected<uint64_t, std::string>> lifetime_test(client_t& X, client_t& Y, net::ipv4& server_addr) {
+    if (X.get_txn_manager() != Y.get_txn_manager()) co_return std::unexpected("X and Y must share a txn manager");
+
     // Phase 1: Exponential search
     constexpr uint64_t ACCEPTABLE_ERROR = 15;
+    const uint64_t limit = lifetime_params{}.limit.count();
     uint64_t low = 0;
     uint64_t high = 0;
     uint64_t lifetime = 10;
@@ -156,18 +317,18 @@ std::expected<uint64_t, std::string> lifetime_test(clientImpl& X, clientImpl& Y,
     while (true) {
         log::async().info("Testing lifetime={}s\n", lifetime);
         stun::message X_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
-        auto res = X.async_req(server_addr, X_msg).get_as_rvalue();
-        if (!res.has_value()) return std::unexpected(res.error());
+        auto res = co_await X.async_req(server_addr, X_msg);
+        if (!res.has_value()) co_return std::unexpected(res.error());
 
-        auto x_addr = std::get<1>(res.value()).find_one<stun::ipv4_xor_mappedAddress>();
-        if (!x_addr) return std::unexpected("server does not support stun-behavior");
+        auto x_addr = std::get<1>(res.value()).template find_one<stun::ipv4_xor_mappedAddress>();
+        if (!x_addr) co_return std::unexpected("server does not support stun-behavior");
         uint16_t X_port = x_addr->get_net_port();
 
-        std::this_thread::sleep_for(std::chrono::seconds(lifetime));
+        co_await coro::timer::delay_awaiter<std::chrono::seconds, typename client_t::clock_t>{std::chrono::seconds(lifetime)};
 
         stun::message Y_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
         Y_msg.emplace<stun::responsePort>(X_port);
-        auto res2 = Y.async_req(server_addr, Y_msg).get_as_rvalue();
+        auto res2 = co_await Y.async_req(server_addr, Y_msg);
 
         if (!res2.has_value()) {
             high = lifetime;
@@ -177,21 +338,22 @@ std::expected<uint64_t, std::string> lifetime_test(clientImpl& X, clientImpl& Y,
 
         auto& Y_res = std::get<1>(res2.value());
         if (Y_res.get_type() == (stun::msg_type::ERROR_RESPONSE | stun::msg_method::BINDING)) {
-            auto err = Y_res.find_one<stun::errorCode>();
-            if (!err) return std::unexpected("Server error: Missing error code");
+            auto err = Y_res.template find_one<stun::errorCode>();
+            if (!err) co_return std::unexpected("Server error: Missing error code");
             
             if (err->error_code == stun::E420_UNKNOWN_ATTRIBUTE) {
                 std::string err_msg = "Unsupported attributes:";
                 for (size_t i = 0; i < err->length/sizeof(uint16_t); i++) {
                     err_msg += math::tohex(math::ntoh(err->unknown_attributes[i]));
                 }
-                return std::unexpected(err_msg);
+                co_return std::unexpected(err_msg);
             }
-            return std::unexpected("Server error: Code=" + std::to_string(err->error_code));
+            co_return std::unexpected("Server error: Code=" + std::to_string(err->error_code));
         }
 
         low = lifetime;
-        lifetime *= 2;
+        if (lifetime >= limit) co_return std::unexpected(std::format("the binding outlived {}s", limit));
+        lifetime = std::min(lifetime * 2, limit);
     }
 
     // Phase 2: Binary search
@@ -200,29 +362,29 @@ std::expected<uint64_t, std::string> lifetime_test(clientImpl& X, clientImpl& Y,
         log::async().info("Testing lifetime={}s\n", mid);
 
         stun::message X_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
-        auto res = X.async_req(server_addr, X_msg).get_as_rvalue();
-        if (!res.has_value()) return std::unexpected(res.error());
+        auto res = co_await X.async_req(server_addr, X_msg);
+        if (!res.has_value()) co_return std::unexpected(res.error());
 
-        auto x_addr = std::get<1>(res.value()).find_one<stun::ipv4_xor_mappedAddress>();
-        if (!x_addr) return std::unexpected("server has undefined behavior");
+        auto x_addr = std::get<1>(res.value()).template find_one<stun::ipv4_xor_mappedAddress>();
+        if (!x_addr) co_return std::unexpected("server has undefined behavior");
         uint16_t X_port = x_addr->get_net_port();
 
-        std::this_thread::sleep_for(std::chrono::seconds(mid));
+        co_await coro::timer::delay_awaiter<std::chrono::seconds, typename client_t::clock_t>{std::chrono::seconds(mid)};
 
         stun::message Y_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
         Y_msg.emplace<stun::responsePort>(X_port);
-        auto res2 = Y.async_req(server_addr, Y_msg).get_as_rvalue();
+        auto res2 = co_await Y.async_req(server_addr, Y_msg);
 
         if (!res2.has_value()) {
             high = mid;
         } else {
             auto& Y_res = std::get<1>(res2.value());
             if (Y_res.get_type() == (stun::msg_type::ERROR_RESPONSE | stun::msg_method::BINDING)) {
-                auto err = Y_res.find_one<stun::errorCode>();
-                if (!err) return std::unexpected("Server error: Missing error code");
+                auto err = Y_res.template find_one<stun::errorCode>();
+                if (!err) co_return std::unexpected("Server error: Missing error code");
                 
                 if (err->error_code == stun::E420_UNKNOWN_ATTRIBUTE) {
-                    return std::unexpected("Unexpected E420 error in binary phase");
+                    co_return std::unexpected("Unexpected E420 error in binary phase");
                 }
                 high = mid;
             } else {
@@ -231,5 +393,128 @@ std::expected<uint64_t, std::string> lifetime_test(clientImpl& X, clientImpl& Y,
         }
     }
 
-    return high;
-}
\ No newline at end of file
+    co_return high;
+}
+
+inline stun::message response_port_msg(uint16_t net_port){
+    stun::message msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+    msg.emplace<stun::responsePort>(net_port);
+    return msg;
+}
+
+// a Binding request from Y asking the server to answer on X's mapped port
+template <typename client_t>
+struct lifetime_probe{
+    stun::message msg;
+    typename client_t::req_task task;
+
+    lifetime_probe(client_t& Y, net::ipv4& server_addr, uint16_t net_port) :
+        msg{response_port_msg(net_port)},
+        task{Y.async_req(server_addr, msg)} {}
+};
+
+template <typename client_t>
+coro::lazy_task<std::expected<uint64_t, std::string>> parallel_lifetime_test(std::span<client_t*> X, client_t& Y, net::ipv4& server_addr, lifetime_params params) {
+    using clock_t = typename client_t::clock_t;
+    using duration = typename clock_t::duration;
+    const size_t K = X.size();
+    if (K == 0) co_return std::unexpected("no bindings to probe");
+    for (auto x : X){
+        if (x->get_txn_manager() != Y.get_txn_manager()) co_return std::unexpected("X and Y must share a txn manager");
+    }
+
+    // lo: oldest age seen alive, hi: youngest age seen expired (once hi_expired)
+    duration lo = duration::zero();
+    duration hi = params.max_lifetime;
+    bool hi_expired = false;
+
+    while (!hi_expired || hi - lo > params.resolution) {
+        std::vector<duration> ages(K);
+        for (size_t j = 0; j < K; j++) {
+            ages[j] = lo + (hi - lo) * (j + 1) / (hi_expired ? K + 1 : K);
+        }
+        log::async().info("Testing {} lifetimes in ({}s, {}s]\n", K,
+            std::chrono::duration_cast<std::chrono::seconds>(lo).count(),
+            std::chrono::duration_cast<std::chrono::seconds>(ages.back()).count());
+
+        // open the oldest binding first, so that all of them reach their age at once
+        std::vector<typename clock_t::time_point> opened(K);
+        std::vector<uint16_t> X_ports(K);
+        auto start = clock_t::now();
+        for (size_t j = K; j-- > 0;) {
+            auto wait = start + (ages.back() - ages[j]) - clock_t::now();
+            if (wait > duration::zero()) {
+                co_await coro::timer::delay_awaiter<duration, clock_t>{wait};
+            }
+
+            stun::message X_msg(stun::msg_method::BINDING | stun::msg_type::REQUEST);
+            opened[j] = clock_t::now();
+            auto res = co_await X[j]->async_req(server_addr, X_msg);
+            if (!res.has_value()) co_return std::unexpected(res.error());
+
+            auto x_addr = std::get<1>(res.value()).template find_one<stun::ipv4_xor_mappedAddress>();
+            if (!x_addr) co_return std::unexpected("server does not support stun-behavior");
+            X_ports[j] = x_addr->get_net_port();
+        }
+
+        auto wait = start + ages.back() - clock_t::now();
+        if (wait > duration::zero()) {
+            co_await coro::timer::delay_awaiter<duration, clock_t>{wait};
+        }
+
+        auto probed = clock_t::now();
+        std::list<lifetime_probe<client_t>> probes;
+        for (size_t j = 0; j < K; j++) {
+            probes.emplace_back(Y, server_addr, X_ports[j]);
+        }
+
+        std::vector<duration> alive, expired;
+        size_t j = 0;
+        for (auto& probe : probes) {
+            auto age = probed - opened[j++];
+            auto& res = co_await probe.task;
+            if (!res.has_value()) {
+                expired.push_back(age);
+                continue;
+            }
+
+            auto& Y_res = std::get<1>(res.value());
+            if (Y_res.get_type() == (stun::msg_type::ERROR_RESPONSE | stun::msg_method::BINDING)) {
+                auto err = Y_res.template find_one<stun::errorCode>();
+                if (!err) co_return std::unexpected("Server error: Missing error code");
+                co_return std::unexpected("Server error: Code=" + std::to_string(err->error_code));
+            }
+            alive.push_back(age);
+        }
+
+        if (!expired.empty()) {
+            hi = std::ranges::min(expired);
+            hi_expired = true;
+        } else if (hi >= params.limit) {
+            co_return std::unexpected(std::format("every binding outlived {}s", params.limit.count()));
+        } else {
+            hi = std::min<duration>(hi * 2, params.limit);
+        }
+        for (auto age : alive) {
+            if (age > lo && age < hi) lo = age;
+        }
+    }
+
+    co_return std::chrono::ceil<std::chrono::seconds>(hi).count();
+}
+
+template std::expected<net::ipv4, std::string> build_binding(clientImpl&, net::ipv4&);
+template coro::lazy_task<std::expected<net::ipv4, std::string>> async_build_binding(clientImpl&, net::ipv4);
+template std::expected<nat_type, std::string> nat_test(clientImpl&, clientImpl&, net::ipv4);
+template coro::lazy_task<std::expected<nat_type, std::string>> async_nat_test(clientImpl&, clientImpl&, net::ipv4);
+template coro::lazy_task<std::expected<bool, std::string>> async_verify_nat_type(clientImpl&, clientImpl&, net::ipv4, nat_type, retransmit_params);
+template coro::lazy_task<std::expected<uint64_t, std::string>> lifetime_test(clientImpl&, clientImpl&, net::ipv4&);
+template coro::lazy_task<std::expected<uint64_t, std::string>> parallel_lifetime_test(std::span<clientImpl*>, clientImpl&, net::ipv4&, lifetime_params);
+
+template std::expected<net::ipv4, std::string> build_binding(sim::client_sim&, net::ipv4&);
+template coro::lazy_task<std::expected<net::ipv4, std::string>> async_build_binding(sim::client_sim&, net::ipv4);
+template std::expected<nat_type, std::string> nat_test(sim::client_sim&, sim::client_sim&, net::ipv4);
+template coro::lazy_task<std::expected<nat_type, std::string>> async_nat_test(sim::client_sim&, sim::client_sim&, net::ipv4);
+template coro::lazy_task<std::expected<bool, std::string>> async_verify_nat_type(sim::client_sim&, sim::client_sim&, net::ipv4, nat_type, retransmit_params);
+template coro::lazy_task<std::expected<uint64_t, std::string>> lifetime_test(sim::client_sim&, sim::client_sim&, net::ipv4&);
+template coro::lazy_task<std::expected<uint64_t, std::string>> parallel_lifetime_test(std::span<sim::client_sim*>, sim::client_sim&, net::ipv4&, lifetime_params);
@@ -1,5 +1,8 @@
+#pragma once
 #include <cstdint>
+#include <chrono>
 #include <expected>
+#include <span>
 #include "client.h"
 
 using clientImpl = client_udpv4;
@@ -24,16 +27,71 @@ constexpr uint8_t port_restricted_cone = 0b0010;
 constexpr uint8_t symmetric = 0b1010;
 
 
+// RFC 5780 4.5, unknown without a NAT or when the test could not run
+enum class hairpinning : uint8_t
+{
+    unknown,
+    supported,
+    unsupported
+};
+
+// RFC 5780 4.6, a padded request past the MTU and, if the server pads its
+// answer, the padded response
+enum class fragment_handling : uint8_t
+{
+    unknown,
+    dropped,
+    // the server answered without PADDING, inbound fragments are untested
+    outbound,
+    passed
+};
+
 struct nat_type
 {
     uint8_t filtering_type;
     uint8_t mapping_type;
+    hairpinning hairpin = hairpinning::unknown;
+    fragment_handling fragments = fragment_handling::unknown;
 
     uint8_t type() const {
         return filtering_type | mapping_type;
     }
+
+    bool operator==(const nat_type&) const = default;
+};
+
+struct lifetime_params
+{
+    // search stops once the lifetime is bracketed this tightly
+    std::chrono::seconds resolution{15};
+    // upper end of the first round, doubled while every binding survives
+    std::chrono::seconds max_lifetime{600};
+    // without a NAT, or with one that never expires bindings, every round
+    // survives; the test fails once a binding has outlived this
+    std::chrono::seconds limit{7200};
 };
 
-std::expected<net::ipv4, std::string> build_binding(clientImpl& c, net::ipv4& server_addr);
-std::expected<nat_type, std::string> nat_test(clientImpl &c, net::ipv4 server_addr);
-std::expected<uint64_t, std::string> lifetime_test(clientImpl& X, clientImpl& Y, net::ipv4& server_addr);
\ No newline at end of file
+// instantiated in nat_test.cpp for clientImpl and sim::client_sim,
+// the async_ forms suspend instead of blocking the calling thread
+template <typename client_t>
+std::expected<net::ipv4, std::string> build_binding(client_t& c, net::ipv4& server_addr);
+template <typename client_t>
+coro::lazy_task<std::expected<net::ipv4, std::string>> async_build_binding(client_t& c, net::ipv4 server_addr);
+// aux is a second socket on the same interface, used for the mapping probes
+template <typename client_t>
+std::expected<nat_type, std::string> nat_test(client_t &c, client_t &aux, net::ipv4 server_addr);
+template <typename client_t>
+coro::lazy_task<std::expected<nat_type, std::string>> async_nat_test(client_t &c, client_t &aux, net::ipv4 server_addr);
+// Confirms the mapping and filtering of a known type with the same probes
+// on a short schedule, seconds instead of a full test's retransmissions.
+// false means the type no longer holds; as a lost probe reads as
+// filtering, a full nat_test should decide.
+template <typename client_t>
+coro::lazy_task<std::expected<bool, std::string>> async_verify_nat_type(client_t &c, client_t &aux, net::ipv4 server_addr, nat_type known, retransmit_params schedule);
+// Y's RESPONSE-PORT answers arrive on X, so Y must share X's txn manager
+template <typename client_t>
+coro::lazy_task<std::expected<uint64_t, std::string>> lifetime_test(client_t& X, client_t& Y, net::ipv4& server_addr);
+// opens X.size() bindings at staggered times and probes them all at once,
+// each round narrowing the bracket by a factor of about X.size() + 1
+template <typename client_t>
+coro::lazy_task<std::expected<uint64_t, std::string>> parallel_lifetime_test(std::span<client_t*> X, client_t& Y, net::ipv4& server_addr, lifetime_params params);
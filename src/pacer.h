@@ -0,0 +1,70 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct pacing{
+    // packets per second, 0 = unpaced
+    double rate = 0;
+    // packets that may leave back to back
+    uint32_t burst = 1;
+};
+
+// process-wide limit shared by every socket
+inline pacing& default_global_pacing(){
+    static pacing p{2000, 64};
+    return p;
+}
+
+// picked up by sockets created afterwards
+inline pacing& default_socket_pacing(){
+    static pacing p{};
+    return p;
+}
+
+// Token bucket in its GCRA form: a send reserves the next slot with one CAS
+// on the theoretical arrival time and is told how long to wait for it, so
+// the caller sleeps on the timer instead of a pacing thread.
+template <typename clock_t>
+class token_bucket{
+private:
+    using rep = typename clock_t::rep;
+    using duration = typename clock_t::duration;
+
+    std::atomic<rep> tat;
+    std::atomic<rep> interval;
+    std::atomic<rep> tolerance;
+
+public:
+    explicit token_bucket(pacing p = {}) : tat{0}, interval{0}, tolerance{0} { configure(p); }
+
+    void configure(pacing p){
+        rep t = p.rate > 0
+            ? std::chrono::duration_cast<duration>(std::chrono::duration<double>(1.0 / p.rate)).count()
+            : 0;
+        interval.store(t, std::memory_order_relaxed);
+        tolerance.store(t * (std::max<uint32_t>(p.burst, 1) - 1), std::memory_order_relaxed);
+    }
+
+    // how long to wait before sending one packet
+    duration reserve(){
+        rep t = interval.load(std::memory_order_relaxed);
+        if (t == 0) return duration::zero();
+
+        rep now = clock_t::now().time_since_epoch().count();
+        rep old = tat.load(std::memory_order_relaxed);
+        rep start;
+        do {
+            start = std::max(old, now);
+        } while (!tat.compare_exchange_weak(old, start + t, std::memory_order_relaxed));
+
+        rep send_at = std::max(now, start - tolerance.load(std::memory_order_relaxed));
+        return duration{send_at - now};
+    }
+
+    static token_bucket& global(){
+        static token_bucket instance{default_global_pacing()};
+        return instance;
+    }
+};
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <format>
+#include <list>
+
+#include "port_prediction.h"
+#include "nat_test.h"
+#include "nat_sim.h"
+#include "stun.h"
+
+namespace {
+    constexpr int32_t port_space = 65536;
+    // below this, gaps between neighbours say little
+    constexpr size_t min_samples = 8;
+    constexpr size_t buckets = 16;
+    // chi-square, 15 degrees of freedom, p = 0.001
+    constexpr double uniform_critical = 37.70;
+
+    uint16_t wrap(int64_t port){
+        return static_cast<uint16_t>(((port % port_space) + port_space) % port_space);
+    }
+
+    double chi_square(std::span<const int32_t> ports, int32_t lo, int32_t span){
+        size_t counts[buckets] = {};
+        for (auto port : ports){
+            auto offset = (port - lo + port_space) % port_space;
+            counts[std::min<size_t>(static_cast<size_t>(offset) * buckets / span, buckets - 1)]++;
+        }
+        double expected = static_cast<double>(ports.size()) / buckets, stat = 0;
+        for (auto c : counts){
+            stat += (c - expected) * (c - expected) / expected;
+        }
+        return stat;
+    }
+}
+
+port_prediction predict_ports(std::span<const port_sample> samples){
+    port_prediction p{allocation_pattern::unknown, 0, 0, 0, 0.0, 0.0};
+    const size_t n = samples.size();
+    if (n < min_samples) return p;
+
+    // columns, so the passes below are branch-free loops over contiguous ints
+    std::vector<int32_t> local(n), mapped(n);
+    for (size_t i = 0; i < n; i++){
+        local[i] = samples[i].local;
+        mapped[i] = samples[i].mapped;
+    }
+
+    size_t preserved = 0;
+    for (size_t i = 0; i < n; i++){
+        preserved += local[i] == mapped[i];
+    }
+    if (preserved * 10 >= n * 9){
+        p.pattern = allocation_pattern::preserving;
+        p.confidence = static_cast<double>(preserved) / n;
+        return p;
+    }
+
+    // gaps between neighbours on the port ring, the last one wraps around
+    std::ranges::sort(mapped);
+    std::vector<int32_t> gaps(n);
+    for (size_t i = 0; i + 1 < n; i++){
+        gaps[i] = mapped[i + 1] - mapped[i];
+    }
+    gaps[n - 1] = mapped[0] + port_space - mapped[n - 1];
+
+    // the widest gap is the part of the ring not handed out (yet): the pool
+    // starts after it and the newest mapping sits right before it
+    size_t widest = std::ranges::max_element(gaps) - gaps.begin();
+    int32_t oldest = mapped[(widest + 1) % n];
+    int32_t newest = mapped[widest];
+    int32_t hull = port_space - gaps[widest] + 1;
+
+    std::vector<int32_t> steps;
+    steps.reserve(n - 1);
+    for (size_t i = 0; i < n; i++){
+        if (i != widest) steps.push_back(gaps[i]);
+    }
+    std::ranges::sort(steps);
+
+    // most common step, from runs in the sorted steps
+    int32_t mode = 0;
+    size_t mode_count = 0;
+    for (size_t i = 0, j; i < steps.size(); i = j){
+        for (j = i; j < steps.size() && steps[j] == steps[i]; j++);
+        if (j - i > mode_count){
+            mode = steps[i];
+            mode_count = j - i;
+        }
+    }
+
+    p.chi_square = chi_square(mapped, oldest, hull);
+
+    // other hosts allocating in between only make some steps wider
+    if (mode > 0 && mode_count * 2 >= steps.size()){
+        int32_t wide = std::max(mode, steps[steps.size() * 9 / 10]);
+        size_t covered = 0;
+        for (auto s : steps){
+            covered += s >= mode && s <= wide;
+        }
+        p.pattern = allocation_pattern::sequential;
+        p.stride = mode;
+        p.first = wrap(int64_t{newest} + mode);
+        p.last = wrap(int64_t{newest} + wide);
+        p.confidence = static_cast<double>(covered) / steps.size();
+        return p;
+    }
+
+    // n samples from a uniform pool leave the next one outside their hull
+    // with chance 2 / (n + 1)
+    p.pattern = p.chi_square < uniform_critical ? allocation_pattern::random : allocation_pattern::unknown;
+    p.first = wrap(oldest);
+    p.last = wrap(newest);
+    p.confidence = static_cast<double>(n - 1) / (n + 1);
+    return p;
+}
+
+std::string describe(const port_prediction& p){
+    switch (p.pattern){
+        case allocation_pattern::preserving:
+            return std::format("port preserving, next mapping keeps the local port (confidence {:.2f})", p.confidence);
+        case allocation_pattern::sequential:
+            return std::format("sequential, stride {}, next mapping in [{}, {}] (confidence {:.2f})", p.stride, p.first, p.last, p.confidence);
+        case allocation_pattern::random:
+            return std::format("random, next mapping in [{}, {}] (confidence {:.2f}, chi-square {:.1f})", p.first, p.last, p.confidence, p.chi_square);
+        default:
+            if (p.first == p.last) return "unknown, too few samples";
+            return std::format("no pattern, observed [{}, {}] (chi-square {:.1f})", p.first, p.last, p.chi_square);
+    }
+}
+
+template <typename client_t>
+struct port_probe{
+    // async_req keeps references to both
+    net::ipv4 server_addr;
+    stun::message msg;
+    typename client_t::req_task task;
+
+    port_probe(client_t& c, net::ipv4 server_addr) :
+        server_addr{server_addr},
+        msg{stun::msg_method::BINDING | stun::msg_type::REQUEST},
+        task{c.async_req(this->server_addr, msg)} {}
+};
+
+template <typename client_t>
+coro::lazy_task<std::expected<std::vector<port_sample>, std::string>> sample_ports(std::span<client_t*> clients, net::ipv4 server_addr){
+    // the pacer decides how fast these leave, not the round trip
+    std::list<port_probe<client_t>> probes;
+    for (auto c : clients){
+        probes.emplace_back(*c, server_addr);
+    }
+
+    std::vector<port_sample> samples;
+    samples.reserve(clients.size());
+    size_t i = 0;
+    for (auto& probe : probes){
+        auto c = clients[i++];
+        auto& res = co_await probe.task;
+        if (!res.has_value()) continue;
+
+        auto x_addr = std::get<1>(res.value()).template find_one<stun::ipv4_xor_mappedAddress>();
+        if (x_addr == nullptr) continue;
+        samples.push_back(port_sample{math::ntoh(c->get_self_addr().net_port), math::ntoh(x_addr->get_net_port())});
+    }
+
+    if (samples.empty()) co_return std::unexpected("no binding request was answered");
+    co_return samples;
+}
+
+template coro::lazy_task<std::expected<std::vector<port_sample>, std::string>> sample_ports(std::span<clientImpl*>, net::ipv4);
+template coro::lazy_task<std::expected<std::vector<port_sample>, std::string>> sample_ports(std::span<sim::client_sim*>, net::ipv4);
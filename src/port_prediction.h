@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "coro/async.h"
+#include "net/ipv4.h"
+
+using namespace seele;
+
+// host byte order
+struct port_sample
+{
+    uint16_t local;
+    uint16_t mapped;
+};
+
+enum class allocation_pattern
+{
+    unknown,
+    // mapped port is the local port
+    preserving,
+    // new mappings step through the port space, possibly with gaps left by other hosts
+    sequential,
+    // uniform over a pool
+    random
+};
+
+struct port_prediction
+{
+    allocation_pattern pattern;
+    // most common step between neighbouring mappings, 0 unless sequential
+    int32_t stride;
+    // where the next new mapping is expected, host byte order; both 0 when
+    // preserving, since it is whatever local port is used
+    uint16_t first;
+    uint16_t last;
+    // estimated chance that the next mapping lands in [first, last]
+    double confidence;
+    // uniformity over the sampled range, chi-square with 15 degrees of freedom
+    double chi_square;
+};
+
+// The order samples come back in is not the order the NAT saw them (the pool
+// may reorder sends), so the mapped ports are sorted around the port ring and
+// the analysis looks at gaps between neighbours rather than at a sequence.
+port_prediction predict_ports(std::span<const port_sample> samples);
+
+// one Binding from every client, all issued before any answer is awaited;
+// instantiated in port_prediction.cpp for clientImpl and sim::client_sim
+template <typename client_t>
+coro::lazy_task<std::expected<std::vector<port_sample>, std::string>> sample_ports(std::span<client_t*> clients, net::ipv4 server_addr);
+
+std::string describe(const port_prediction& p);
@@ -0,0 +1,127 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+
+// RFC 5389 7.2.1: Rc transmissions with the interval doubling from RTO,
+// then Rm * RTO after the last one before giving up
+struct retransmit_params{
+    uint32_t Rc = 7;
+    uint32_t Rm = 16;
+    std::chrono::microseconds initial_rto{500'000};
+    std::chrono::microseconds min_rto{100'000};
+    std::chrono::microseconds max_rto{3'000'000};
+
+    // wait after the i-th transmission
+    inline std::chrono::microseconds interval(std::chrono::microseconds rto, uint32_t i) const {
+        return i + 1 < Rc ? rto * (int64_t{1} << std::min<uint32_t>(i, 30)) : rto * static_cast<int64_t>(Rm);
+    }
+};
+
+// picked up by estimators created afterwards, e.g. set from the command line
+inline retransmit_params& default_retransmit_params(){
+    static retransmit_params params;
+    return params;
+}
+
+// RFC 6298 SRTT/RTTVAR per destination. Callers follow Karn's rule and only
+// sample transactions that were sent once. At most max_entries destinations
+// are kept, the one sampled least recently makes room.
+template <typename ipinfo_t>
+class rto_estimator{
+private:
+    struct entry{
+        std::chrono::microseconds srtt;
+        std::chrono::microseconds rttvar;
+        std::chrono::microseconds rto;
+        std::chrono::microseconds min_rtt;
+        uint64_t used;
+    };
+
+    std::mutex m;
+    std::map<ipinfo_t, entry> entries;
+    uint64_t uses;
+    retransmit_params params;
+
+    // with m held
+    entry& touch(const ipinfo_t& dest){
+        auto [it, inserted] = entries.try_emplace(dest, entry{{}, {}, params.initial_rto, {}, 0});
+        it->second.used = ++uses;
+        if (inserted && entries.size() > max_entries){
+            entries.erase(std::ranges::min_element(entries, {}, [](auto& e){ return e.second.used; }));
+        }
+        return it->second;
+    }
+
+    inline std::chrono::microseconds clamp(std::chrono::microseconds rto) const {
+        return std::clamp(rto, params.min_rto, params.max_rto);
+    }
+
+public:
+    static constexpr size_t max_entries = 1024;
+
+    explicit rto_estimator() : uses{0}, params{default_retransmit_params()} {}
+
+    inline void set_params(const retransmit_params& p){
+        std::lock_guard lock{m};
+        params = p;
+    }
+
+    inline retransmit_params get_params(){
+        std::lock_guard lock{m};
+        return params;
+    }
+
+    inline std::chrono::microseconds rto(const ipinfo_t& dest){
+        std::lock_guard lock{m};
+        auto it = entries.find(dest);
+        return it == entries.end() ? params.initial_rto : it->second.rto;
+    }
+
+    // empty until dest has been sampled
+    inline std::optional<std::chrono::microseconds> srtt(const ipinfo_t& dest){
+        std::lock_guard lock{m};
+        auto it = entries.find(dest);
+        if (it == entries.end() || it->second.srtt == std::chrono::microseconds::zero()) return std::nullopt;
+        return it->second.srtt;
+    }
+
+    // the fastest sample, empty until dest has been sampled
+    inline std::optional<std::chrono::microseconds> min_rtt(const ipinfo_t& dest){
+        std::lock_guard lock{m};
+        auto it = entries.find(dest);
+        if (it == entries.end() || it->second.min_rtt == std::chrono::microseconds::zero()) return std::nullopt;
+        return it->second.min_rtt;
+    }
+
+    template <typename rep, typename period>
+    void sample(const ipinfo_t& dest, std::chrono::duration<rep, period> measured){
+        using namespace std::chrono;
+        auto r = std::max(duration_cast<microseconds>(measured), microseconds{1});
+
+        std::lock_guard lock{m};
+        auto& e = touch(dest);
+        // first measurement, possibly after backoffs
+        e.min_rtt = e.min_rtt == microseconds::zero() ? r : std::min(e.min_rtt, r);
+        if (e.srtt == microseconds::zero()){
+            e.srtt = r;
+            e.rttvar = r / 2;
+        } else {
+            // beta = 1/4, alpha = 1/8
+            auto err = e.srtt > r ? e.srtt - r : r - e.srtt;
+            e.rttvar = (3 * e.rttvar + err) / 4;
+            e.srtt = (7 * e.srtt + r) / 8;
+        }
+        e.rto = clamp(e.srtt + 4 * e.rttvar);
+    }
+
+    // RFC 6298 5.5, kept until the next sample
+    void backoff(const ipinfo_t& dest){
+        std::lock_guard lock{m};
+        auto& e = touch(dest);
+        e.rto = clamp(e.rto * 2);
+    }
+};
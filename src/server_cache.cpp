@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <utility>
+
+#include "server_cache.h"
+#include "log.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr char MAGIC[8] = {'S', 'T', 'U', 'N', 'S', 'V', 'C', 0};
+
+    int64_t unix_now(){
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    size_t home_slot(uint64_t key, size_t capacity){
+        return (key * 0x9E3779B97F4A7C15ull >> 32) % capacity;
+    }
+
+    size_t home_slot(const net::ipv4& server, size_t capacity){
+        return home_slot((static_cast<uint64_t>(server.net_address) << 16) | server.net_port, capacity);
+    }
+}
+
+server_cache::server_cache() :
+    #if defined(_WIN32) || defined(_WIN64)
+    file{nullptr}, mapping{nullptr},
+    #elif defined(__linux__)
+    fd{-1},
+    #endif
+    base{nullptr} {}
+
+server_cache::server_cache(server_cache&& other) : server_cache() {
+    *this = std::move(other);
+}
+
+server_cache& server_cache::operator=(server_cache&& other){
+    if (this != &other){
+        close();
+        #if defined(_WIN32) || defined(_WIN64)
+        file = std::exchange(other.file, nullptr);
+        mapping = std::exchange(other.mapping, nullptr);
+        #elif defined(__linux__)
+        fd = std::exchange(other.fd, -1);
+        #endif
+        base = std::exchange(other.base, nullptr);
+    }
+    return *this;
+}
+
+server_cache::~server_cache(){
+    close();
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+std::expected<void, std::string> server_cache::map(std::string_view path){
+    file = CreateFileA(std::string(path).c_str(), GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE){
+        file = nullptr;
+        return std::unexpected(std::format("failed to open server cache {}: error {}", path, GetLastError()));
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, FILE_SIZE, nullptr);
+    if (mapping == nullptr){
+        return std::unexpected(std::format("failed to map server cache {}: error {}", path, GetLastError()));
+    }
+
+    base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, FILE_SIZE);
+    if (base == nullptr){
+        return std::unexpected(std::format("failed to map server cache {}: error {}", path, GetLastError()));
+    }
+    return {};
+}
+#elif defined(__linux__)
+std::expected<void, std::string> server_cache::map(std::string_view path){
+    fd = ::open(std::string(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1){
+        return std::unexpected(std::format("failed to open server cache {}: {}", path, strerror(errno)));
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == -1){
+        return std::unexpected(std::format("failed to stat server cache {}: {}", path, strerror(errno)));
+    }
+    if (static_cast<size_t>(st.st_size) != FILE_SIZE && ftruncate(fd, FILE_SIZE) == -1){
+        return std::unexpected(std::format("failed to resize server cache {}: {}", path, strerror(errno)));
+    }
+
+    void* p = mmap(nullptr, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED){
+        return std::unexpected(std::format("failed to map server cache {}: {}", path, strerror(errno)));
+    }
+    base = p;
+    return {};
+}
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+server_cache::file_lock::file_lock(const server_cache& cache, bool exclusive) : cache{cache} {
+    OVERLAPPED ov{};
+    LockFileEx(cache.file, exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, MAXDWORD, MAXDWORD, &ov);
+}
+
+server_cache::file_lock::~file_lock(){
+    OVERLAPPED ov{};
+    UnlockFileEx(cache.file, 0, MAXDWORD, MAXDWORD, &ov);
+}
+#elif defined(__linux__)
+server_cache::file_lock::file_lock(const server_cache& cache, bool exclusive) : cache{cache} {
+    while (::flock(cache.fd, exclusive ? LOCK_EX : LOCK_SH) == -1 && errno == EINTR);
+}
+
+server_cache::file_lock::~file_lock(){
+    ::flock(cache.fd, LOCK_UN);
+}
+#endif
+
+std::expected<server_cache, std::string> server_cache::open(std::string_view path){
+    std::error_code ec;
+    auto dir = std::filesystem::path(path).parent_path();
+    if (!dir.empty()) std::filesystem::create_directories(dir, ec);
+
+    server_cache cache;
+    if (auto res = cache.map(path); !res.has_value()){
+        return std::unexpected(std::move(res.error()));
+    }
+
+    {
+        // released before cache is moved out
+        file_lock lock{cache, true};
+        auto h = cache.header();
+        if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->version != VERSION || h->capacity != CAPACITY){
+            if (h->magic[0] != 0){
+                log::sync().warn("server cache {} has an unknown layout, resetting it\n", path);
+            }
+            std::memset(cache.base, 0, FILE_SIZE);
+            std::memcpy(h->magic, MAGIC, sizeof(MAGIC));
+            h->version = VERSION;
+            h->capacity = CAPACITY;
+        }
+    }
+    return cache;
+}
+
+void server_cache::close(){
+    #if defined(_WIN32) || defined(_WIN64)
+    if (base != nullptr) UnmapViewOfFile(base);
+    if (mapping != nullptr) CloseHandle(mapping);
+    if (file != nullptr) CloseHandle(file);
+    file = mapping = base = nullptr;
+    #elif defined(__linux__)
+    if (base != nullptr) munmap(base, FILE_SIZE);
+    if (fd != -1) ::close(fd);
+    fd = -1;
+    base = nullptr;
+    #endif
+}
+
+server_record* server_cache::slot(const net::ipv4& server, bool insert){
+    auto rs = records();
+    size_t home = home_slot(server, CAPACITY);
+    for (size_t i = 0; i < CAPACITY; i++){
+        auto& r = rs[(home + i) % CAPACITY];
+        if (!r.used()){
+            if (!insert) return nullptr;
+            r = server_record{};
+            r.net_address = server.net_address;
+            r.net_port = server.net_port;
+            r.flags = server_record::USED;
+            return &r;
+        }
+        if (r.server() == server) return &r;
+    }
+    if (!insert) return nullptr;
+
+    // full, evict whatever lives in the home slot
+    auto& r = rs[home];
+    r = server_record{};
+    r.net_address = server.net_address;
+    r.net_port = server.net_port;
+    r.flags = server_record::USED;
+    return &r;
+}
+
+const server_record* server_cache::find(const net::ipv4& server) const{
+    return const_cast<server_cache*>(this)->slot(server, false);
+}
+
+void server_cache::record_success(const net::ipv4& server, bool behavior_discovery, std::optional<std::chrono::nanoseconds> rtt){
+    file_lock lock{*this, true};
+    auto r = slot(server, true);
+    auto now = unix_now();
+    r->last_attempt = now;
+    r->last_success = now;
+    r->failures = 0;
+    r->successes++;
+    if (behavior_discovery){
+        r->flags |= server_record::BEHAVIOR_DISCOVERY;
+    } else {
+        r->flags &= ~server_record::BEHAVIOR_DISCOVERY;
+    }
+
+    if (rtt.has_value()){
+        auto us = std::clamp<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(rtt.value()).count(), 1, UINT32_MAX);
+        r->srtt_us = r->srtt_us == 0
+            ? static_cast<uint32_t>(us)
+            : static_cast<uint32_t>((7 * static_cast<int64_t>(r->srtt_us) + us) / 8);
+    }
+}
+
+void server_cache::record_failure(const net::ipv4& server){
+    file_lock lock{*this, true};
+    auto r = slot(server, true);
+    r->last_attempt = unix_now();
+    r->failures++;
+}
+
+uint64_t server_cache::score(const server_record* r, int64_t now) const{
+    if (r == nullptr) return UNKNOWN;
+    if (r->failures >= FAILURES_BEFORE_DEMOTED) return UNKNOWN + r->failures;
+    if (r->last_success == 0 || now - r->last_success > std::chrono::seconds(STALE_AFTER).count()) return UNKNOWN;
+    // answered but never timed, e.g. from a nat test run
+    if (r->srtt_us == 0) return UNKNOWN - 1;
+    // each recent failure costs like 100ms of rtt
+    return r->srtt_us + uint64_t{r->failures} * 100'000;
+}
+
+std::vector<net::ipv4> server_cache::rank(std::span<const net::ipv4> servers) const{
+    file_lock lock{*this, false};
+    auto now = unix_now();
+    std::vector<std::pair<uint64_t, net::ipv4>> scored;
+    scored.reserve(servers.size());
+    for (auto& server : servers){
+        scored.emplace_back(score(find(server), now), server);
+    }
+    std::ranges::stable_sort(scored, {}, [](auto& p){ return p.first; });
+
+    std::vector<net::ipv4> res;
+    res.reserve(scored.size());
+    for (auto& [_, server] : scored){
+        res.push_back(server);
+    }
+    return res;
+}
+
+std::optional<server_record> server_cache::best(bool need_behavior_discovery) const{
+    file_lock lock{*this, false};
+    auto now = unix_now();
+    auto rs = records();
+    const server_record* best = nullptr;
+    uint64_t best_score = UNKNOWN;
+    for (size_t i = 0; i < CAPACITY; i++){
+        auto& r = rs[i];
+        if (!r.used()) continue;
+        if (need_behavior_discovery && !r.behavior_discovery()) continue;
+        auto s = score(&r, now);
+        if (s < best_score){
+            best = &r;
+            best_score = s;
+        }
+    }
+    if (best == nullptr) return std::nullopt;
+    return *best;
+}
+
+nat_record* server_cache::nat_slot(uint32_t local_address, uint32_t gateway_address, bool insert){
+    auto rs = nat_records();
+    size_t home = home_slot((static_cast<uint64_t>(local_address) << 32) | gateway_address, NAT_CAPACITY);
+    nat_record* oldest = &rs[home];
+    for (size_t i = 0; i < NAT_CAPACITY; i++){
+        auto& r = rs[(home + i) % NAT_CAPACITY];
+        // forget_nat leaves holes, so look at every slot before inserting
+        if (r.used() && r.local_address == local_address && r.gateway_address == gateway_address) return &r;
+        if (!r.used()){
+            if (oldest->used()) oldest = &r;
+        } else if (oldest->used() && r.tested_at < oldest->tested_at){
+            oldest = &r;
+        }
+    }
+    if (!insert) return nullptr;
+
+    // a free slot if there is one, the stalest result otherwise
+    *oldest = nat_record{};
+    oldest->local_address = local_address;
+    oldest->gateway_address = gateway_address;
+    oldest->flags = nat_record::USED;
+    return oldest;
+}
+
+const nat_record* server_cache::find_nat(uint32_t local_address, uint32_t gateway_address, std::chrono::seconds ttl) const{
+    auto r = const_cast<server_cache*>(this)->nat_slot(local_address, gateway_address, false);
+    if (r == nullptr || unix_now() - r->tested_at > ttl.count()) return nullptr;
+    return r;
+}
+
+void server_cache::record_nat(uint32_t local_address, uint32_t gateway_address, uint32_t public_address, uint8_t mapping_type, uint8_t filtering_type, uint8_t hairpinning, uint8_t fragments){
+    file_lock lock{*this, true};
+    auto r = nat_slot(local_address, gateway_address, true);
+    r->public_address = public_address;
+    r->mapping_type = mapping_type;
+    r->filtering_type = filtering_type;
+    r->behaviors = static_cast<uint8_t>((fragments << 4) | (hairpinning & 0x0F));
+    r->tested_at = unix_now();
+}
+
+void server_cache::forget_nat(uint32_t local_address, uint32_t gateway_address){
+    file_lock lock{*this, true};
+    if (auto r = nat_slot(local_address, gateway_address, false); r != nullptr){
+        *r = nat_record{};
+    }
+}
+
+std::optional<std::string> default_cache_path(){
+    #if defined(_WIN32) || defined(_WIN64)
+    if (auto dir = std::getenv("LOCALAPPDATA"); dir != nullptr && *dir != 0){
+        return std::format("{}\\stun-client.cache", dir);
+    }
+    #elif defined(__linux__)
+    if (auto dir = std::getenv("XDG_CACHE_HOME"); dir != nullptr && *dir != 0){
+        return std::format("{}/stun-client.cache", dir);
+    }
+    if (auto home = std::getenv("HOME"); home != nullptr && *home != 0){
+        return std::format("{}/.cache/stun-client.cache", home);
+    }
+    #endif
+    return std::nullopt;
+}
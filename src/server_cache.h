@@ -0,0 +1,154 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "net/ipv4.h"
+
+using namespace seele;
+
+// Per-server health kept across runs. Plain old data, the file is the array.
+struct server_record
+{
+    uint32_t net_address;
+    uint16_t net_port;
+    uint8_t flags;
+    uint8_t reserved;
+    // consecutive, reset by a success
+    uint32_t failures;
+    uint32_t successes;
+    // smoothed rtt in microseconds, 0 until measured
+    uint32_t srtt_us;
+    // seconds since epoch, 0 if never
+    int64_t last_success;
+    int64_t last_attempt;
+
+    static constexpr uint8_t USED = 0x01;
+    static constexpr uint8_t BEHAVIOR_DISCOVERY = 0x02;
+
+    inline bool used() const { return flags & USED; }
+    inline bool behavior_discovery() const { return flags & BEHAVIOR_DISCOVERY; }
+    inline net::ipv4 server() const { return net::ipv4{net_address, net_port}; }
+};
+static_assert(sizeof(server_record) == 40);
+
+// NAT type measured behind one local address and gateway, trusted while the
+// public address it was measured at still comes back in a Binding response
+struct nat_record
+{
+    uint32_t local_address;
+    uint32_t gateway_address;
+    uint32_t public_address;
+    uint8_t mapping_type;
+    uint8_t filtering_type;
+    uint8_t flags;
+    // hairpinning in the low nibble, fragment handling in the high one;
+    // 0 is unknown for both, as in files written before they were tested
+    uint8_t behaviors;
+    // seconds since epoch
+    int64_t tested_at;
+
+    static constexpr uint8_t USED = 0x01;
+
+    inline bool used() const { return flags & USED; }
+    inline uint8_t hairpinning() const { return behaviors & 0x0F; }
+    inline uint8_t fragments() const { return behaviors >> 4; }
+};
+static_assert(sizeof(nat_record) == 24);
+
+// Memory-mapped fixed-capacity open-addressing table of server_record,
+// followed by a small one of nat_record.
+// A file with a foreign magic, version or capacity is reset, not rejected.
+// Processes sharing the file, e.g. a -D daemon and one-shot runs, take an
+// exclusive file lock around every change and a shared one while ranking;
+// pointers from find() and find_nat() are read unlocked. One object is not
+// to be used from several threads at once.
+class server_cache{
+private:
+    // flock() on Linux, LockFileEx() on Windows, released on destruction
+    class file_lock{
+    private:
+        const server_cache& cache;
+    public:
+        explicit file_lock(const server_cache& cache, bool exclusive);
+        file_lock(const file_lock&) = delete;
+        file_lock& operator=(const file_lock&) = delete;
+        ~file_lock();
+    };
+
+    struct file_header{
+        char magic[8];
+        uint32_t version;
+        uint32_t capacity;
+        uint64_t reserved;
+    };
+
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t CAPACITY = 1024;
+    static constexpr uint32_t NAT_CAPACITY = 64;
+    static constexpr size_t FILE_SIZE = sizeof(file_header) + CAPACITY * sizeof(server_record) + NAT_CAPACITY * sizeof(nat_record);
+    // records older than this are ranked like unknown servers
+    static constexpr std::chrono::hours STALE_AFTER{24 * 7};
+    static constexpr uint32_t FAILURES_BEFORE_DEMOTED = 3;
+    // unknown servers sit between healthy and failing ones
+    static constexpr uint64_t UNKNOWN = uint64_t{1} << 32;
+
+    #if defined(_WIN32) || defined(_WIN64)
+    void* file;
+    void* mapping;
+    #elif defined(__linux__)
+    int fd;
+    #endif
+    void* base;
+
+    explicit server_cache();
+
+    inline file_header* header() const { return static_cast<file_header*>(base); }
+    inline server_record* records() const {
+        return reinterpret_cast<server_record*>(static_cast<char*>(base) + sizeof(file_header));
+    }
+    inline nat_record* nat_records() const {
+        return reinterpret_cast<nat_record*>(records() + CAPACITY);
+    }
+
+    std::expected<void, std::string> map(std::string_view path);
+    server_record* slot(const net::ipv4& server, bool insert);
+    nat_record* nat_slot(uint32_t local_address, uint32_t gateway_address, bool insert);
+    // lower is better
+    uint64_t score(const server_record* r, int64_t now) const;
+    void close();
+
+public:
+    server_cache(const server_cache&) = delete;
+    server_cache(server_cache&&);
+    server_cache& operator=(const server_cache&) = delete;
+    server_cache& operator=(server_cache&&);
+    ~server_cache();
+
+    static std::expected<server_cache, std::string> open(std::string_view path);
+
+    const server_record* find(const net::ipv4& server) const;
+
+    // rtt is folded into the estimate like RFC 6298 SRTT (alpha = 1/8)
+    void record_success(const net::ipv4& server, bool behavior_discovery, std::optional<std::chrono::nanoseconds> rtt);
+    void record_failure(const net::ipv4& server);
+
+    // fresh and fast first, unknown next, failing last
+    std::vector<net::ipv4> rank(std::span<const net::ipv4> servers) const;
+    // best server in the whole cache that answered recently
+    std::optional<server_record> best(bool need_behavior_discovery) const;
+
+    // nullptr if never tested here or older than ttl
+    const nat_record* find_nat(uint32_t local_address, uint32_t gateway_address, std::chrono::seconds ttl) const;
+    void record_nat(uint32_t local_address, uint32_t gateway_address, uint32_t public_address, uint8_t mapping_type, uint8_t filtering_type, uint8_t hairpinning, uint8_t fragments);
+    void forget_nat(uint32_t local_address, uint32_t gateway_address);
+};
+
+// $XDG_CACHE_HOME/stun-client.cache, ~/.cache/stun-client.cache or %LOCALAPPDATA%\stun-client.cache
+std::optional<std::string> default_cache_path();
@@ -1,4 +1,5 @@
 #include "stun.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
@@ -25,8 +26,8 @@ namespace stun {
 
 
 
-    message::message(uint16_t type) {
-        this->data = (std::byte*) std::aligned_alloc(alignof(stun::header), 548);
+    message::message(uint16_t type, size_t capacity) : capacity{capacity} {
+        this->data = (std::byte*) std::aligned_alloc(alignof(stun::header), capacity);
         
         
         this->header = new (this->data) stun::header{};
@@ -45,8 +46,8 @@ namespace stun {
         std::memcpy(&tmpHeader, p, sizeof(stun::header));
         size_t size = sizeof(stun::header) + ntoh(tmpHeader.length);
 
-        
-        this->data = (std::byte*) std::aligned_alloc(alignof(stun::header), 548);
+        this->capacity = std::max(size, default_message_size);
+        this->data = (std::byte*) std::aligned_alloc(alignof(stun::header), this->capacity);
         std::memcpy(this->data, p, size);
         this->header = reinterpret_cast<stun::header*>(this->data);
         this->endptr = this->data + sizeof(stun::header) + ntoh(this->header->length);
@@ -64,7 +65,7 @@ namespace stun {
     }
 
     message::message(message&& other) noexcept
-        : data{other.data}, header{other.header}, attributes{std::move(other.attributes)}, endptr{other.endptr} {
+        : data{other.data}, header{other.header}, attributes{std::move(other.attributes)}, endptr{other.endptr}, capacity{other.capacity} {
         other.data = nullptr;
         other.header = nullptr;
         other.endptr = nullptr;
@@ -81,6 +82,7 @@ namespace stun {
             header = other.header;
             attributes = std::move(other.attributes);
             endptr = other.endptr;
+            capacity = other.capacity;
 
             other.data = nullptr;
             other.header = nullptr;
@@ -89,12 +91,26 @@ namespace stun {
         return *this;
     }
 
+    bool message::pad(uint16_t length) {
+        size_t value = (size_t{length} + 3) & ~size_t{3};
+        if (this->endptr + sizeof(attr) + value > data + capacity) {
+            return false;
+        }
+
+        auto padding = new (this->endptr) attr{stun::attribute::PADDING, hton<uint16_t>(static_cast<uint16_t>(value))};
+        std::memset(padding->get_value_ptr(), 0, value);
+        this->attributes.emplace_back(padding);
+        this->endptr += sizeof(attr) + value;
+        this->setLength(endptr - data - sizeof(stun::header));
+        return true;
+    }
+
     bool message::is_valid(std::byte* p) {
         if (static_cast<uint8_t>(*p) & 0b11000000) return false;
 
         auto h = reinterpret_cast<stun::header*>(p);
         if (h->magicCookie != stun::MAGIC_COOKIE) return false;
-        if (ntoh(h->length) + sizeof(stun::header) > 548) return false;
+        if (ntoh(h->length) + sizeof(stun::header) > max_message_size) return false;
         if (ntoh(h->length) % 4 != 0) return false;
 
         return true;
@@ -163,6 +179,21 @@ namespace stun {
                         str += std::format("   RESPONSE_PORT: {}\n", ntoh(responseport->port));
                     }
                     break;
+                case stun::attribute::PADDING:
+                    str += std::format("   PADDING: {} bytes\n", ntoh(attr->length));
+                    break;
+                case stun::attribute::PRIORITY:
+                    {
+                        auto priority = attr->as<icePriority>();
+                        str += std::format("   PRIORITY: {}\n", ntoh(priority->priority));
+                    }
+                    break;
+                case stun::attribute::ICE_CONTROLLING:
+                    str += std::format("   ICE_CONTROLLING: {}\n", tohex(attr->as<iceControlling>()->get_tie_breaker()));
+                    break;
+                case stun::attribute::ICE_CONTROLLED:
+                    str += std::format("   ICE_CONTROLLED: {}\n", tohex(attr->as<iceControlled>()->get_tie_breaker()));
+                    break;
                 default:
                     {
                         str += std::format("   UNKNOWN ATTRIBUTE: type: {}, length: {}, value: {}\n", tohex(attr->type), ntoh(attr->length), tohex(attr->get_value_ptr(), ntoh(attr->length)));
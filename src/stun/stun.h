@@ -44,6 +44,11 @@ namespace stun {
 
     constexpr uint32_t MAGIC_COOKIE = hton<uint32_t>(0x2112A442);
 
+    // RFC 5389 7.1: without a known path MTU a message stays within 548 bytes
+    constexpr size_t default_message_size = 548;
+    // RFC 5780 7.6: PADDING is the exception, it is meant to fragment
+    constexpr size_t max_message_size = 2048;
+
 }
 
 #include "stunAttribute.inl"
@@ -55,12 +60,13 @@ namespace stun {
         stun::header* header;
         std::vector<attr*> attributes;
         std::byte* endptr;
+        size_t capacity;
 
         inline void setLength(uint16_t length) { header->length = math::hton<uint16_t>(length); }
 
     public:
-        inline explicit message() : data{nullptr}, header{nullptr}, endptr{nullptr} {}
-        explicit message(uint16_t type);
+        inline explicit message() : data{nullptr}, header{nullptr}, endptr{nullptr}, capacity{0} {}
+        explicit message(uint16_t type, size_t capacity = default_message_size);
         explicit message(const std::byte* p);
         
         message(const message&) = delete;
@@ -71,6 +77,7 @@ namespace stun {
         message& operator=(message&& other) noexcept;
 
         inline const txn_id_t& get_txn_id() const { return header->txn_id; }
+        inline void set_txn_id(const txn_id_t& id) { header->txn_id = id; }
         inline const std::vector<attr*>& get_attrs() const { return attributes; }
         inline const std::byte* data_ptr() const { return data; }
         inline size_t size() const { return endptr - data; }
@@ -83,6 +90,9 @@ namespace stun {
         template <is_stunAttribute attribute_t, typename... args_t>
         bool emplace(args_t&&... args);
 
+        // RFC 5780 7.6, length is rounded up to a multiple of 4
+        bool pad(uint16_t length);
+
         template <is_stunAttribute attribute_t>
         attribute_t* find_one();
 
@@ -97,7 +107,7 @@ namespace stun {
 
     template <is_stunAttribute attribute_t>
     bool message::append(attribute_t* attribute) {
-        if (this->endptr + sizeof(attribute_t) > data + 548) {
+        if (this->endptr + sizeof(attribute_t) > data + capacity) {
             return false;
         }
 
@@ -110,7 +120,7 @@ namespace stun {
 
     template <is_stunAttribute attribute_t, typename... args_t>
     bool message::emplace(args_t&&... args) {
-        if (this->endptr + sizeof(attribute_t) > data + 548) {
+        if (this->endptr + sizeof(attribute_t) > data + capacity) {
             return false;
         }
 
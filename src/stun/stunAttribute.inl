@@ -21,6 +21,12 @@ namespace stun {
         constexpr uint16_t RESPONSE_ORIGIN = hton<uint16_t>(0x802B);
         constexpr uint16_t OTHER_ADDRESS = hton<uint16_t>(0x802C);
 
+        // RFC 8445
+        constexpr uint16_t PRIORITY = hton<uint16_t>(0x0024);
+        constexpr uint16_t USE_CANDIDATE = hton<uint16_t>(0x0025);
+        constexpr uint16_t ICE_CONTROLLED = hton<uint16_t>(0x8029);
+        constexpr uint16_t ICE_CONTROLLING = hton<uint16_t>(0x802A);
+
 
 
         // don't have to be understood
@@ -28,6 +34,8 @@ namespace stun {
         constexpr uint16_t ALTERNATE_SERVER = hton<uint16_t>(0x8023);
         constexpr uint16_t FINGERPRINT = hton<uint16_t>(0x8028);
     }
+    constexpr uint8_t IPV4_FAMILY = 0x01;
+
     constexpr uint32_t CHANGE_IP_FLAG = hton<uint32_t>(0x04);
     constexpr uint32_t CHANGE_PORT_FLAG = hton<uint32_t>(0x02);
 
@@ -67,6 +75,9 @@ namespace stun {
         uint16_t port;
         uint32_t address;
         constexpr static uint16_t getid(){ return stun::attribute::MAPPED_ADDRESS;}
+        explicit ipv4_mappedAddress(uint32_t address, uint16_t port) : 
+            attr{stun::attribute::MAPPED_ADDRESS, math::hton<uint16_t>(8)}, 
+            zero{0}, family{IPV4_FAMILY}, port{port}, address{address} {}
     };
 
     struct ipv4_xor_mappedAddress : public attr {
@@ -82,6 +93,11 @@ namespace stun {
             return net_x_address ^ stun::MAGIC_COOKIE;
         }
         constexpr static uint16_t getid(){ return stun::attribute::XOR_MAPPED_ADDRESS;}
+        explicit ipv4_xor_mappedAddress(uint32_t net_address, uint16_t net_port) : 
+            attr{stun::attribute::XOR_MAPPED_ADDRESS, math::hton<uint16_t>(8)}, 
+            zero{0}, family{IPV4_FAMILY}, 
+            net_x_port{static_cast<uint16_t>(net_port ^ stun::MAGIC_COOKIE)}, 
+            net_x_address{net_address ^ stun::MAGIC_COOKIE} {}
     };
 
     struct ipv4_responseOrigin : public attr {
@@ -90,6 +106,9 @@ namespace stun {
         uint16_t port;
         uint32_t address;
         constexpr static uint16_t getid(){ return stun::attribute::RESPONSE_ORIGIN;}
+        explicit ipv4_responseOrigin(uint32_t address, uint16_t port) : 
+            attr{stun::attribute::RESPONSE_ORIGIN, math::hton<uint16_t>(8)}, 
+            zero{0}, family{IPV4_FAMILY}, port{port}, address{address} {}
     };
 
     struct ipv4_otherAddress : public attr {
@@ -98,6 +117,9 @@ namespace stun {
         uint16_t port;
         uint32_t address;
         constexpr static uint16_t getid(){ return stun::attribute::OTHER_ADDRESS;}
+        explicit ipv4_otherAddress(uint32_t address, uint16_t port) : 
+            attr{stun::attribute::OTHER_ADDRESS, math::hton<uint16_t>(8)}, 
+            zero{0}, family{IPV4_FAMILY}, port{port}, address{address} {}
     };
 
     struct changeRequest : public attr {
@@ -109,11 +131,43 @@ namespace stun {
             flags{flags} {}
     };
 
+    struct icePriority : public attr {
+        uint32_t priority;
+        constexpr static uint16_t getid(){ return stun::attribute::PRIORITY;}
+        explicit icePriority(uint32_t priority) :
+            attr{stun::attribute::PRIORITY, math::hton<uint16_t>(sizeof(priority))},
+            priority{priority} {}
+    };
+
+    // the 64 bit tie breaker is split so the attribute stays 4 byte aligned
+    template <uint16_t id>
+    struct iceRole : public attr {
+        uint32_t tie_breaker_hi;
+        uint32_t tie_breaker_lo;
+        constexpr static uint16_t getid(){ return id;}
+        explicit iceRole(uint64_t tie_breaker) :
+            attr{id, math::hton<uint16_t>(8)},
+            tie_breaker_hi{math::hton<uint32_t>(static_cast<uint32_t>(tie_breaker >> 32))},
+            tie_breaker_lo{math::hton<uint32_t>(static_cast<uint32_t>(tie_breaker))} {}
+
+        inline uint64_t get_tie_breaker() const {
+            return (static_cast<uint64_t>(math::ntoh(tie_breaker_hi)) << 32) | math::ntoh(tie_breaker_lo);
+        }
+    };
+    using iceControlling = iceRole<stun::attribute::ICE_CONTROLLING>;
+    using iceControlled = iceRole<stun::attribute::ICE_CONTROLLED>;
+
     struct softWare : public attr {
         char value[0];
         constexpr static uint16_t getid(){ return stun::attribute::SOFTWARE;}
     };
 
+    // built with message::pad, the value does not matter
+    struct padding : public attr {
+        std::byte value[0];
+        constexpr static uint16_t getid(){ return stun::attribute::PADDING;}
+    };
+
 
     struct fingerPrint : public attr {
         uint32_t crc32;
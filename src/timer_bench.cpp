@@ -0,0 +1,77 @@
+#include <coroutine>
+#include <map>
+#include <random>
+#include "timer_bench.h"
+#include "struct/timing_wheel.h"
+
+namespace bench {
+
+    namespace {
+        using clock = std::chrono::steady_clock;
+        using value_t = std::coroutine_handle<>;
+
+        constexpr uint64_t ms = 1'000'000;
+        constexpr uint64_t horizon = 300'000 * ms;
+        constexpr uint64_t step = ms;
+
+        std::vector<uint64_t> deadlines(size_t count, uint64_t seed){
+            std::mt19937_64 rng{seed};
+            std::uniform_int_distribution<uint64_t> at{1, horizon / ms};
+            std::vector<uint64_t> out(count);
+            for (auto& d : out) d = at(rng) * ms;
+            return out;
+        }
+
+        timer_result run_wheel(const std::vector<uint64_t>& when){
+            timer_result r{"timing wheel", {}, {}, {}, 0};
+            seele::structs::timing_wheel<value_t> wheel;
+            std::vector<seele::structs::timing_wheel<value_t>::id_t> ids;
+            ids.reserve(when.size());
+
+            auto start = clock::now();
+            for (auto w : when) ids.push_back(wheel.insert(w, value_t{}));
+            r.insert = clock::now() - start;
+
+            start = clock::now();
+            for (size_t i = 0; i < ids.size(); i += 2) wheel.erase(ids[i]);
+            r.cancel = clock::now() - start;
+
+            start = clock::now();
+            for (uint64_t now = 0; !wheel.empty(); now += step){
+                while (wheel.pop(now)) r.expired++;
+            }
+            r.expire = clock::now() - start;
+            return r;
+        }
+
+        timer_result run_multimap(const std::vector<uint64_t>& when){
+            timer_result r{"std::multimap", {}, {}, {}, 0};
+            std::multimap<uint64_t, value_t> tasks;
+            std::vector<std::multimap<uint64_t, value_t>::iterator> ids;
+            ids.reserve(when.size());
+
+            auto start = clock::now();
+            for (auto w : when) ids.push_back(tasks.emplace(w, value_t{}));
+            r.insert = clock::now() - start;
+
+            start = clock::now();
+            for (size_t i = 0; i < ids.size(); i += 2) tasks.erase(ids[i]);
+            r.cancel = clock::now() - start;
+
+            start = clock::now();
+            for (uint64_t now = 0; !tasks.empty(); now += step){
+                while (!tasks.empty() && tasks.begin()->first <= now){
+                    tasks.erase(tasks.begin());
+                    r.expired++;
+                }
+            }
+            r.expire = clock::now() - start;
+            return r;
+        }
+    }
+
+    std::vector<timer_result> run_timer_bench(size_t count, uint64_t seed){
+        auto when = deadlines(count, seed);
+        return {run_wheel(when), run_multimap(when)};
+    }
+}
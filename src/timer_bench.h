@@ -0,0 +1,23 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Times the timer queue behind coro::timer against the std::multimap it
+// replaced: count timers with millisecond deadlines (so many share one)
+// spread over a few minutes, like retransmits and keepalives, then half of
+// them cancelled and the rest expired in 1ms steps.
+namespace bench {
+
+    struct timer_result{
+        std::string name;
+        std::chrono::nanoseconds insert;
+        std::chrono::nanoseconds cancel;
+        std::chrono::nanoseconds expire;
+        // expired timers, to check both agree
+        size_t expired;
+    };
+
+    std::vector<timer_result> run_timer_bench(size_t count, uint64_t seed);
+}